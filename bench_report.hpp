@@ -0,0 +1,345 @@
+//
+// Machine-readable (JSON and CSV) benchmark results with device and run metadata.
+//
+
+#ifndef BENCH_REPORT_HPP
+#define BENCH_REPORT_HPP
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <CL/opencl.h>
+#include "program_cache.hpp"
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+namespace benchreport {
+
+// Device identity as dev_query prints it
+struct DeviceInfo {
+   std::string name;
+   std::string vendor;
+   std::string type;
+   std::string platform;
+   std::string device_version;
+   std::string driver_version;
+   std::string opencl_c_version;
+   cl_uint compute_units = 0;
+   cl_uint max_clock_mhz = 0;
+   cl_ulong global_mem_bytes = 0;
+   cl_ulong max_alloc_bytes = 0;
+   cl_ulong local_mem_bytes = 0;
+   bool unified_memory = false;
+};
+
+inline std::string type_name(cl_device_type type) {
+   if (type & CL_DEVICE_TYPE_GPU) return "GPU";
+   if (type & CL_DEVICE_TYPE_CPU) return "CPU";
+   if (type & CL_DEVICE_TYPE_ACCELERATOR) return "ACCELERATOR";
+   return "OTHER";
+}
+
+inline DeviceInfo describe(cl_device_id device) {
+   DeviceInfo info;
+   info.name = clcache::device_string(device, CL_DEVICE_NAME);
+   info.vendor = clcache::device_string(device, CL_DEVICE_VENDOR);
+   info.device_version = clcache::device_string(device, CL_DEVICE_VERSION);
+   info.driver_version = clcache::device_string(device, CL_DRIVER_VERSION);
+   info.opencl_c_version = clcache::device_string(device, CL_DEVICE_OPENCL_C_VERSION);
+   cl_device_type type = 0;
+   cl_platform_id platform = nullptr;
+   cl_bool unified = CL_FALSE;
+   clGetDeviceInfo(device, CL_DEVICE_TYPE, sizeof(type), &type, nullptr);
+   clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr);
+   clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(info.compute_units), &info.compute_units, nullptr);
+   clGetDeviceInfo(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(info.max_clock_mhz), &info.max_clock_mhz, nullptr);
+   clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(info.global_mem_bytes), &info.global_mem_bytes, nullptr);
+   clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(info.max_alloc_bytes), &info.max_alloc_bytes, nullptr);
+   clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(info.local_mem_bytes), &info.local_mem_bytes, nullptr);
+   clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, nullptr);
+   info.type = type_name(type);
+   info.unified_memory = unified == CL_TRUE;
+   if (platform != nullptr)
+      info.platform = clcache::platform_string(platform, CL_PLATFORM_NAME);
+   return info;
+}
+
+// A "device" that is not one OpenCL device: the native host backend, or several devices sharing one run
+inline DeviceInfo host_device(const std::string &name, const std::string &type = "HOST") {
+   DeviceInfo info;
+   info.name = name;
+   info.type = type;
+   return info;
+}
+
+inline std::string utc_timestamp() {
+   std::time_t now = std::time(nullptr);
+   char stamp[32];
+   std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+   return stamp;
+}
+
+inline std::string host_name() {
+#ifdef __unix__
+   char name[256] = {0};
+   if (gethostname(name, sizeof(name) - 1) == 0)
+      return name;
+#endif
+   return "";
+}
+
+inline std::string json_string(const std::string &text) {
+   std::string quoted = "\"";
+   for (char c : text) {
+      switch (c) {
+         case '"': quoted += "\\\""; break;
+         case '\\': quoted += "\\\\"; break;
+         case '\n': quoted += "\\n"; break;
+         case '\t': quoted += "\\t"; break;
+         default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+               char escaped[8];
+               std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+               quoted += escaped;
+            } else {
+               quoted += c;
+            }
+      }
+   }
+   return quoted + "\"";
+}
+
+inline std::string csv_field(const std::string &text) {
+   if (text.find_first_of(",\"\n") == std::string::npos)
+      return text;
+   std::string quoted = "\"";
+   for (char c : text)
+      quoted += c == '"' ? std::string("\"\"") : std::string(1, c);
+   return quoted + "\"";
+}
+
+inline std::string json_device(const DeviceInfo &info, const std::string &indent) {
+   std::ostringstream out;
+   out << "{\n"
+       << indent << "  \"name\": " << json_string(info.name) << ",\n"
+       << indent << "  \"vendor\": " << json_string(info.vendor) << ",\n"
+       << indent << "  \"type\": " << json_string(info.type) << ",\n"
+       << indent << "  \"platform\": " << json_string(info.platform) << ",\n"
+       << indent << "  \"device_version\": " << json_string(info.device_version) << ",\n"
+       << indent << "  \"driver_version\": " << json_string(info.driver_version) << ",\n"
+       << indent << "  \"opencl_c_version\": " << json_string(info.opencl_c_version) << ",\n"
+       << indent << "  \"compute_units\": " << info.compute_units << ",\n"
+       << indent << "  \"max_clock_mhz\": " << info.max_clock_mhz << ",\n"
+       << indent << "  \"global_mem_bytes\": " << info.global_mem_bytes << ",\n"
+       << indent << "  \"max_alloc_bytes\": " << info.max_alloc_bytes << ",\n"
+       << indent << "  \"local_mem_bytes\": " << info.local_mem_bytes << ",\n"
+       << indent << "  \"unified_memory\": " << (info.unified_memory ? "true" : "false") << "\n"
+       << indent << "}";
+   return out.str();
+}
+
+inline const char *device_csv_header() {
+   return "name,vendor,type,platform,device_version,driver_version,opencl_c_version,compute_units,"
+          "max_clock_mhz,global_mem_bytes,max_alloc_bytes,local_mem_bytes,unified_memory";
+}
+
+inline std::string device_csv(const DeviceInfo &info) {
+   std::ostringstream out;
+   out << csv_field(info.name) << "," << csv_field(info.vendor) << "," << info.type << ","
+       << csv_field(info.platform) << "," << csv_field(info.device_version) << ","
+       << csv_field(info.driver_version) << "," << csv_field(info.opencl_c_version) << ","
+       << info.compute_units << "," << info.max_clock_mhz << "," << info.global_mem_bytes << ","
+       << info.max_alloc_bytes << "," << info.local_mem_bytes << "," << (info.unified_memory ? 1 : 0);
+   return out.str();
+}
+
+// One device's run: its identity, how it was configured, and every timing sample per metric (ms)
+struct Record {
+   DeviceInfo device;
+   std::vector<std::pair<std::string, std::string>> config;
+   std::vector<std::pair<std::string, std::vector<double>>> samples;
+
+   void set(const std::string &key, const std::string &value) { config.emplace_back(key, value); }
+   void add(const std::string &metric, const std::vector<double> &values) { samples.emplace_back(metric, values); }
+};
+
+/**
+ * All records of one tool invocation. JSON keeps the full structure; CSV
+ * has one row per sample with the configuration folded into a
+ * "key=value;..." column, ready for spreadsheets and dataframes.
+ */
+class Report {
+public:
+   explicit Report(const std::string &tool) : tool_(tool), timestamp_(utc_timestamp()), host_(host_name()) {}
+
+   // The reference is only valid until the next add()
+   Record &add(const DeviceInfo &device) {
+      records_.push_back(Record());
+      records_.back().device = device;
+      return records_.back();
+   }
+
+   const std::vector<Record> &records() const { return records_; }
+
+   // "key=value;..." as in the CSV config column
+   static std::string config_string(const Record &record) {
+      std::string config;
+      for (auto &entry : record.config)
+         config += (config.empty() ? "" : ";") + entry.first + "=" + entry.second;
+      return config;
+   }
+
+   bool write_json(const std::string &path) const {
+      std::ofstream out(path, std::ios::trunc);
+      out << "{\n"
+          << "  \"tool\": " << json_string(tool_) << ",\n"
+          << "  \"timestamp\": " << json_string(timestamp_) << ",\n"
+          << "  \"host\": " << json_string(host_) << ",\n"
+          << "  \"runs\": [";
+      out.precision(17);
+      for (size_t r = 0; r < records_.size(); ++r) {
+         const Record &record = records_[r];
+         out << (r ? ",\n" : "\n") << "    {\n"
+             << "      \"device\": " << json_device(record.device, "      ") << ",\n"
+             << "      \"config\": {";
+         for (size_t c = 0; c < record.config.size(); ++c)
+            out << (c ? ", " : "") << json_string(record.config[c].first) << ": "
+                << json_string(record.config[c].second);
+         out << "},\n"
+             << "      \"samples_ms\": {";
+         for (size_t m = 0; m < record.samples.size(); ++m) {
+            out << (m ? ",\n" : "\n") << "        " << json_string(record.samples[m].first) << ": [";
+            const std::vector<double> &values = record.samples[m].second;
+            for (size_t v = 0; v < values.size(); ++v)
+               out << (v ? ", " : "") << values[v];
+            out << "]";
+         }
+         out << (record.samples.empty() ? "}\n" : "\n      }\n") << "    }";
+      }
+      out << (records_.empty() ? "]\n" : "\n  ]\n") << "}\n";
+      return static_cast<bool>(out);
+   }
+
+   bool write_csv(const std::string &path) const {
+      std::ofstream out(path, std::ios::trunc);
+      out << "tool,timestamp,host,device,vendor,type,driver_version,config,metric,sample,value_ms\n";
+      out.precision(17);
+      for (const Record &record : records_) {
+         const std::string config = config_string(record);
+         for (auto &metric : record.samples)
+            for (size_t v = 0; v < metric.second.size(); ++v)
+               out << csv_field(tool_) << "," << timestamp_ << "," << csv_field(host_) << ","
+                   << csv_field(record.device.name) << "," << csv_field(record.device.vendor) << ","
+                   << record.device.type << "," << csv_field(record.device.driver_version) << ","
+                   << csv_field(config) << "," << csv_field(metric.first) << "," << v << ","
+                   << metric.second[v] << "\n";
+      }
+      return static_cast<bool>(out);
+   }
+
+private:
+   std::string tool_;
+   std::string timestamp_;
+   std::string host_;
+   std::vector<Record> records_;
+};
+
+// Split one CSV line as written by csv_field()
+inline std::vector<std::string> csv_split(const std::string &line) {
+   std::vector<std::string> fields(1);
+   bool quoted = false;
+   for (size_t c = 0; c < line.size(); ++c) {
+      if (quoted && line[c] == '"' && c + 1 < line.size() && line[c + 1] == '"') {
+         fields.back() += '"';
+         ++c;
+      } else if (line[c] == '"') {
+         quoted = !quoted;
+      } else if (line[c] == ',' && !quoted) {
+         fields.emplace_back();
+      } else if (line[c] != '\r') {
+         fields.back() += line[c];
+      }
+   }
+   return fields;
+}
+
+/**
+ * Read the records of a CSV written by Report::write_csv back in, one per
+ * device and configuration with all of its metrics. Only the device fields
+ * the CSV carries are filled in. Returns false if the file cannot be read,
+ * is not such a CSV, or holds the same device and configuration twice
+ * (several runs pasted together), as there is no telling which to trust.
+ */
+inline bool read_csv(const std::string &path, std::vector<Record> *records) {
+   std::ifstream in(path);
+   std::string line;
+   if (!std::getline(in, line) || csv_split(line).size() != 11 || csv_split(line)[0] != "tool")
+      return false;
+   std::map<std::string, size_t> index;  // device and config -> record
+   while (std::getline(in, line)) {
+      std::vector<std::string> fields = csv_split(line);
+      if (fields.size() != 11)
+         continue;
+      const std::string key = fields[3] + "\n" + fields[7];
+      auto found = index.find(key);
+      if (found == index.end()) {
+         Record record;
+         record.device.name = fields[3];
+         record.device.vendor = fields[4];
+         record.device.type = fields[5];
+         record.device.driver_version = fields[6];
+         std::istringstream config(fields[7]);
+         std::string entry;
+         while (std::getline(config, entry, ';')) {
+            size_t equals = entry.find('=');
+            if (equals != std::string::npos)
+               record.set(entry.substr(0, equals), entry.substr(equals + 1));
+         }
+         found = index.emplace(key, records->size()).first;
+         records->push_back(record);
+      }
+      Record &record = (*records)[found->second];
+      if (fields[9] == "0")
+         for (auto &metric : record.samples)
+            if (metric.first == fields[8])
+               return false;  // the metric starts over: a second record with this key
+      if (record.samples.empty() || record.samples.back().first != fields[8])
+         record.add(fields[8], std::vector<double>());
+      record.samples.back().second.push_back(atof(fields[10].c_str()));
+   }
+   return true;
+}
+
+// dev_query's device list
+inline bool write_devices_json(const std::string &path, const std::string &tool,
+                               const std::vector<DeviceInfo> &devices) {
+   std::ofstream out(path, std::ios::trunc);
+   out << "{\n"
+       << "  \"tool\": " << json_string(tool) << ",\n"
+       << "  \"timestamp\": " << json_string(utc_timestamp()) << ",\n"
+       << "  \"host\": " << json_string(host_name()) << ",\n"
+       << "  \"devices\": [";
+   for (size_t d = 0; d < devices.size(); ++d)
+      out << (d ? ",\n" : "\n") << "    " << json_device(devices[d], "    ");
+   out << (devices.empty() ? "]\n" : "\n  ]\n") << "}\n";
+   return static_cast<bool>(out);
+}
+
+inline bool write_devices_csv(const std::string &path, const std::vector<DeviceInfo> &devices) {
+   std::ofstream out(path, std::ios::trunc);
+   out << device_csv_header() << "\n";
+   for (auto &device : devices)
+      out << device_csv(device) << "\n";
+   return static_cast<bool>(out);
+}
+
+}
+
+#endif
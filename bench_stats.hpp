@@ -0,0 +1,118 @@
+//
+// Summary statistics over repeated benchmark samples.
+//
+
+#ifndef BENCH_STATS_HPP
+#define BENCH_STATS_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace benchstats {
+
+struct Summary {
+   size_t count = 0;
+   double min = 0;
+   double median = 0;
+   double mean = 0;
+   double p95 = 0;
+   double p99 = 0;
+   double max = 0;
+   double stddev = 0;
+};
+
+// Linearly interpolated percentile of an already sorted sample, q in [0, 1]
+inline double percentile(const std::vector<double> &sorted, double q) {
+   if (sorted.empty())
+      return 0;
+   double rank = q * (sorted.size() - 1);
+   size_t lower = static_cast<size_t>(std::floor(rank));
+   size_t upper = std::min(lower + 1, sorted.size() - 1);
+   return sorted[lower] + (rank - lower) * (sorted[upper] - sorted[lower]);
+}
+
+inline Summary summarize(std::vector<double> samples) {
+   Summary summary;
+   summary.count = samples.size();
+   if (samples.empty())
+      return summary;
+   std::sort(samples.begin(), samples.end());
+   summary.min = samples.front();
+   summary.max = samples.back();
+   summary.median = percentile(samples, 0.5);
+   summary.p95 = percentile(samples, 0.95);
+   summary.p99 = percentile(samples, 0.99);
+   double sum = 0;
+   for (double sample : samples)
+      sum += sample;
+   summary.mean = sum / samples.size();
+   if (samples.size() > 1) {
+      double squares = 0;
+      for (double sample : samples)
+         squares += (sample - summary.mean) * (sample - summary.mean);
+      summary.stddev = std::sqrt(squares / (samples.size() - 1));
+   }
+   return summary;
+}
+
+/**
+ * Two-sided Mann-Whitney U test: the probability of samples at least this
+ * far apart in rank if a and b came from the same distribution. Uses the
+ * normal approximation with tie and continuity corrections, which is
+ * reasonable from about 8 samples per side; fewer samples can never reach
+ * small p-values.
+ */
+inline double mann_whitney_p(const std::vector<double> &a, const std::vector<double> &b) {
+   const size_t n1 = a.size(), n2 = b.size(), total = n1 + n2;
+   if (n1 == 0 || n2 == 0)
+      return 1;
+   // pool both samples, remembering which side each value came from
+   std::vector<std::pair<double, bool>> pooled;
+   for (double value : a) pooled.emplace_back(value, true);
+   for (double value : b) pooled.emplace_back(value, false);
+   std::sort(pooled.begin(), pooled.end());
+   double rank_sum_a = 0, ties = 0;
+   for (size_t first = 0; first < total; ) {
+      size_t last = first;
+      while (last + 1 < total && pooled[last + 1].first == pooled[first].first)
+         ++last;
+      const double rank = (first + last) / 2.0 + 1;  // tied values share their average rank
+      const double group = static_cast<double>(last - first + 1);
+      ties += group * group * group - group;
+      for (size_t i = first; i <= last; ++i)
+         if (pooled[i].second)
+            rank_sum_a += rank;
+      first = last + 1;
+   }
+   const double u = rank_sum_a - n1 * (n1 + 1) / 2.0;
+   const double mean = n1 * n2 / 2.0;
+   const double variance = n1 * n2 / 12.0 * ((total + 1) - ties / (static_cast<double>(total) * (total - 1)));
+   if (variance <= 0)
+      return 1;
+   const double z = std::max(0.0, std::fabs(u - mean) - 0.5) / std::sqrt(variance);
+   return std::erfc(z / std::sqrt(2.0));
+}
+
+inline void print_header(const std::string &unit) {
+   std::cout << "  " << std::left << std::setw(12) << ("metric (" + unit + ")") << std::right
+             << std::setw(11) << "min" << std::setw(11) << "median" << std::setw(11) << "mean"
+             << std::setw(11) << "p95" << std::setw(11) << "p99" << std::setw(11) << "stddev" << std::endl;
+}
+
+inline void print_row(const std::string &name, const Summary &summary) {
+   std::cout << "  " << std::left << std::setw(12) << name << std::right << std::fixed << std::setprecision(3)
+             << std::setw(11) << summary.min << std::setw(11) << summary.median << std::setw(11) << summary.mean
+             << std::setw(11) << summary.p95 << std::setw(11) << summary.p99 << std::setw(11) << summary.stddev
+             << std::endl;
+   std::cout.unsetf(std::ios_base::floatfield);
+   std::cout << std::setprecision(6);
+}
+
+}
+
+#endif
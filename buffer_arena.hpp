@@ -0,0 +1,201 @@
+//
+// One large device buffer per device, suballocated with clCreateSubBuffer.
+//
+
+#ifndef BUFFER_ARENA_HPP
+#define BUFFER_ARENA_HPP
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+#include "cl_raii.hpp"
+
+namespace clarena {
+
+enum class Strategy {
+   bump,      // regions are carved off the end; space comes back only once every region is freed
+   free_list  // first fit over a sorted list of free ranges, neighbours merged on free
+};
+
+inline Strategy parse_strategy(const std::string &name) {
+   return name == "bump" ? Strategy::bump : Strategy::free_list;
+}
+
+inline const char *strategy_name(Strategy strategy) {
+   return strategy == Strategy::bump ? "bump" : "free-list";
+}
+
+struct Stats {
+   size_t capacity = 0;
+   size_t in_use = 0;          // bytes of live regions, alignment padding included
+   size_t peak = 0;            // highest in_use so far
+   size_t allocations = 0;
+   size_t failures = 0;        // requests that did not fit
+   size_t free_bytes = 0;      // reusable right now
+   size_t largest_free = 0;    // the biggest request that would fit right now
+   // 0 when all free space is one range, towards 1 as it splinters
+   double fragmentation() const {
+      return free_bytes ? 1.0 - static_cast<double>(largest_free) / free_bytes : 0.0;
+   }
+};
+
+/**
+ * The offset bookkeeping of an Arena, apart from any OpenCL object: hands
+ * out [origin, origin + size) ranges of capacity bytes by the arena's
+ * strategy. Sizes are taken as given, so callers round them first.
+ */
+class Ranges {
+public:
+   Ranges(size_t capacity, Strategy strategy) : capacity_(capacity), strategy_(strategy) {
+      free_.push_back(Range{0, capacity});
+   }
+
+   bool reserve(size_t size, size_t *origin) {
+      // bump: free_ only ever holds the tail, so first fit is the bump pointer
+      for (size_t r = 0; r < free_.size(); ++r) {
+         if (free_[r].size < size)
+            continue;
+         *origin = free_[r].origin;
+         free_[r].origin += size;
+         free_[r].size -= size;
+         if (free_[r].size == 0 && strategy_ == Strategy::free_list)
+            free_.erase(free_.begin() + r);
+         live_++;
+         return true;
+      }
+      return false;
+   }
+
+   void release(size_t origin, size_t size) {
+      live_--;
+      if (strategy_ == Strategy::bump) {
+         // nothing is reused until the arena is empty again
+         if (live_ == 0)
+            free_.assign(1, Range{0, capacity_});
+         return;
+      }
+      auto next = std::lower_bound(free_.begin(), free_.end(), origin,
+                                   [](const Range &range, size_t value) { return range.origin < value; });
+      next = free_.insert(next, Range{origin, size});
+      // merge with the following and then the preceding range
+      if (next + 1 != free_.end() && next->origin + next->size == (next + 1)->origin) {
+         next->size += (next + 1)->size;
+         free_.erase(next + 1);
+      }
+      if (next != free_.begin() && (next - 1)->origin + (next - 1)->size == next->origin) {
+         (next - 1)->size += next->size;
+         free_.erase(next);
+      }
+   }
+
+   size_t free_bytes() const {
+      size_t bytes = 0;
+      for (const Range &range : free_)
+         bytes += range.size;
+      return bytes;
+   }
+
+   size_t largest_free() const {
+      size_t largest = 0;
+      for (const Range &range : free_)
+         largest = std::max(largest, range.size);
+      return largest;
+   }
+
+   // Number of separate free ranges
+   size_t pieces() const { return free_.size(); }
+
+private:
+   struct Range {
+      size_t origin;
+      size_t size;
+   };
+
+   size_t capacity_;
+   Strategy strategy_;
+   std::vector<Range> free_;
+   size_t live_ = 0;
+};
+
+/**
+ * Owns one CL_MEM_READ_WRITE buffer of capacity bytes and hands out
+ * regions of it as sub-buffers whose origins respect the device's
+ * CL_DEVICE_MEM_BASE_ADDR_ALIGN. Allocation is bookkeeping plus
+ * clCreateSubBuffer, with no device memory allocation on the hot path.
+ * Regions come back when their lease ends. Not thread-safe; leases must not
+ * outlive the arena.
+ */
+class Arena {
+public:
+   Arena(cl_context context, cl_device_id device, size_t capacity, Strategy strategy, cl_int *err)
+           : strategy_(strategy), ranges_(0, strategy) {
+      cl_uint align_bits = 0;
+      clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(align_bits), &align_bits, nullptr);
+      alignment_ = std::max<size_t>(align_bits / 8, 64);
+      capacity = capacity / alignment_ * alignment_;
+      parent_ = clwrap::create_buffer(context, CL_MEM_READ_WRITE, std::max(capacity, alignment_), nullptr, err);
+      if (*err != CL_SUCCESS)
+         return;
+      stats_.capacity = capacity;
+      ranges_ = Ranges(capacity, strategy);
+   }
+
+   Arena(const Arena &) = delete;
+   Arena &operator=(const Arena &) = delete;
+
+   size_t alignment() const { return alignment_; }
+   Strategy strategy() const { return strategy_; }
+
+   // A region of at least bytes as a sub-buffer with the given access flags; CL_MEM_OBJECT_ALLOCATION_FAILURE if full
+   clwrap::Lease<cl_mem> allocate(cl_mem_flags flags, size_t bytes, cl_int *err) {
+      const size_t size = std::max<size_t>((bytes + alignment_ - 1) / alignment_ * alignment_, alignment_);
+      size_t origin;
+      if (!ranges_.reserve(size, &origin)) {
+         stats_.failures++;
+         *err = CL_MEM_OBJECT_ALLOCATION_FAILURE;
+         return clwrap::Lease<cl_mem>();
+      }
+      cl_buffer_region region = {origin, size};
+      clwrap::Buffer sub(clCreateSubBuffer(parent_.get(), flags, CL_BUFFER_CREATE_TYPE_REGION, &region, err));
+      if (*err != CL_SUCCESS) {
+         ranges_.release(origin, size);
+         return clwrap::Lease<cl_mem>();
+      }
+      stats_.allocations++;
+      stats_.in_use += size;
+      stats_.peak = std::max(stats_.peak, stats_.in_use);
+      return clwrap::Lease<cl_mem>(std::move(sub), [this, origin, size](clwrap::Buffer &&returned) {
+         returned.reset();
+         stats_.in_use -= size;
+         ranges_.release(origin, size);
+      });
+   }
+
+   Stats stats() const {
+      Stats stats = stats_;
+      stats.free_bytes = ranges_.free_bytes();
+      stats.largest_free = ranges_.largest_free();
+      return stats;
+   }
+
+   void print_stats(const std::string &name) const {
+      Stats stats = this->stats();
+      std::cout << "Arena on " << name << " (" << strategy_name(strategy_) << ", " << alignment_
+                << " byte alignment): peak " << stats.peak << " of " << stats.capacity << " bytes, "
+                << stats.allocations << " allocations, " << stats.failures << " failed, "
+                << "fragmentation " << stats.fragmentation() << std::endl;
+   }
+
+private:
+   Strategy strategy_;
+   size_t alignment_ = 64;
+   clwrap::Buffer parent_;
+   Ranges ranges_;
+   Stats stats_;
+};
+
+}
+
+#endif
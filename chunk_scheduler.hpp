@@ -0,0 +1,157 @@
+//
+// Dynamic chunk scheduling of one vector addition over devices and host threads.
+//
+
+#ifndef CHUNK_SCHEDULER_HPP
+#define CHUNK_SCHEDULER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <CL/opencl.h>
+#include "hetero.hpp"
+#include "host_simd.hpp"
+
+namespace clsched {
+
+/**
+ * Lock-free guided self-scheduling over [0, n). Every call to next() claims
+ * remaining / (2 * workers) elements, clamped to [min_chunk, max_chunk],
+ * so chunks start large and shrink towards the end of the range where
+ * they keep every worker busy until the last element.
+ */
+class GuidedQueue {
+public:
+   GuidedQueue(size_t n, size_t workers, size_t min_chunk, size_t max_chunk)
+           : n_(n), workers_(std::max<size_t>(workers, 1)), min_chunk_(std::max<size_t>(min_chunk, 1)),
+             max_chunk_(std::max(max_chunk, min_chunk)), next_(0) {}
+
+   bool next(size_t &offset, size_t &count) {
+      size_t current = next_.load(std::memory_order_relaxed);
+      for (;;) {
+         if (current >= n_)
+            return false;
+         size_t remaining = n_ - current;
+         size_t claim = std::min(std::max(remaining / (2 * workers_), min_chunk_), max_chunk_);
+         claim = std::min(claim, remaining);
+         if (next_.compare_exchange_weak(current, current + claim, std::memory_order_relaxed)) {
+            offset = current;
+            count = claim;
+            return true;
+         }
+      }
+   }
+
+private:
+   const size_t n_;
+   const size_t workers_;
+   const size_t min_chunk_;
+   const size_t max_chunk_;
+   std::atomic<size_t> next_;
+};
+
+// What one device or host thread did during a dynamic run
+struct Report {
+   std::string name;
+   size_t chunks = 0;
+   size_t elements = 0;
+   double busy_ms = 0;
+   cl_int err = CL_SUCCESS;
+};
+
+// The host's share uses the same SIMD loop as the native backend
+inline void add_on_host(const float *a, const float *b, float *c, size_t offset, size_t count) {
+   hostsimd::add(a, b, c, offset, offset + count);
+}
+
+/**
+ * Compute c = a + b with every device worker (buffers of at least
+ * max_chunk elements already allocated) and host_threads native threads
+ * pulling chunks from one GuidedQueue. Chunks a failing device had claimed,
+ * and any left when all workers stopped, are computed on the host
+ * afterwards, so c is always complete; the failure stays in that device's
+ * Report::err, and such a run's timing includes the serial recovery.
+ */
+inline std::vector<Report> run_dynamic(std::vector<clhetero::Worker> &devices, int host_threads,
+                                       const float *a, const float *b, float *c, size_t n,
+                                       size_t min_chunk, size_t max_chunk, size_t local_size) {
+   const size_t total_workers = devices.size() + std::max(host_threads, 0);
+   GuidedQueue queue(n, total_workers, min_chunk, max_chunk);
+   std::vector<Report> reports(total_workers);
+   std::mutex failed_mutex;
+   std::vector<std::pair<size_t, size_t>> failed;
+
+   std::vector<std::thread> threads;
+   for (size_t d = 0; d < devices.size(); ++d) {
+      reports[d].name = devices[d].name;
+      threads.emplace_back([&, d]() {
+         clhetero::Worker &worker = devices[d];
+         Report &report = reports[d];
+         size_t offset, count;
+         while (report.err == CL_SUCCESS && queue.next(offset, count)) {
+            auto begin = std::chrono::steady_clock::now();
+            report.err = clhetero::run_slice(worker, a, b, c, offset, count, local_size);
+            if (report.err != CL_SUCCESS) {
+               std::lock_guard<std::mutex> lock(failed_mutex);
+               failed.emplace_back(offset, count);
+               break;
+            }
+            report.busy_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            report.chunks++;
+            report.elements += count;
+         }
+      });
+   }
+   for (size_t h = devices.size(); h < total_workers; ++h) {
+      reports[h].name = "host thread " + std::to_string(h - devices.size());
+      threads.emplace_back([&, h]() {
+         Report &report = reports[h];
+         size_t offset, count;
+         while (queue.next(offset, count)) {
+            auto begin = std::chrono::steady_clock::now();
+            add_on_host(a, b, c, offset, count);
+            report.busy_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            report.chunks++;
+            report.elements += count;
+         }
+      });
+   }
+   for (auto &thread : threads)
+      thread.join();
+
+   // Chunks left behind by failed devices, or unclaimed if every worker stopped early
+   for (auto &chunk : failed)
+      add_on_host(a, b, c, chunk.first, chunk.second);
+   size_t offset, count;
+   while (queue.next(offset, count))
+      add_on_host(a, b, c, offset, count);
+   return reports;
+}
+
+// First device error of a run, CL_SUCCESS if every worker finished its chunks
+inline cl_int first_error(const std::vector<Report> &reports) {
+   for (auto &report : reports)
+      if (report.err != CL_SUCCESS)
+         return report.err;
+   return CL_SUCCESS;
+}
+
+inline void print_reports(const std::vector<Report> &reports) {
+   for (auto &report : reports) {
+      std::cout << " " << report.name << ": " << report.chunks << " chunks, " << report.elements << " elements, "
+                << report.elements * 3 * sizeof(float) / 1e6 << " MB, busy " << report.busy_ms << " ms";
+      if (report.err != CL_SUCCESS)
+         std::cout << ", stopped after error " << report.err;
+      std::cout << std::endl;
+   }
+}
+
+}
+
+#endif
@@ -0,0 +1,142 @@
+//
+// Event based per-phase timing for OpenCL command queues.
+//
+
+#ifndef CL_PROFILE_HPP
+#define CL_PROFILE_HPP
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+
+namespace clprofile {
+
+// Device timestamps (nanoseconds) of one enqueued command
+struct Phase {
+   std::string name;
+   cl_ulong queued;
+   cl_ulong submit;
+   cl_ulong start;
+   cl_ulong end;
+};
+
+// Host side measurement taken with cxxtimer, in microseconds
+struct HostPhase {
+   std::string name;
+   long long micros;
+};
+
+// Read the four profiling timestamps of a completed event.
+// The queue must have been created with CL_QUEUE_PROFILING_ENABLE.
+inline cl_int read_phase(cl_event event, Phase &phase) {
+   cl_int err = clWaitForEvents(1, &event);
+   err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &phase.queued, nullptr);
+   err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &phase.submit, nullptr);
+   err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &phase.start, nullptr);
+   err |= clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &phase.end, nullptr);
+   return err;
+}
+
+// Elapsed device time between start and end of a profiled event, in nanoseconds
+inline cl_ulong event_duration(cl_event event) {
+   Phase phase;
+   if (read_phase(event, phase) != CL_SUCCESS || phase.end < phase.start)
+      return 0;
+   return phase.end - phase.start;
+}
+
+/**
+ * Collects the events of one run and prints a per-phase breakdown.
+ * Ownership of every event passed to add() is taken over by the profile.
+ */
+class Profile {
+public:
+   Profile() = default;
+   Profile(const Profile &) = delete;
+   Profile &operator=(const Profile &) = delete;
+
+   ~Profile() {
+      reset_events();
+   }
+
+   // Release all device events collected so far, keeping the host phases
+   void reset_events() {
+      for (auto &event : events_)
+         clReleaseEvent(event.second);
+      events_.clear();
+   }
+
+   void add(const std::string &name, cl_event event) {
+      if (event != nullptr)
+         events_.emplace_back(name, event);
+   }
+
+   void add_host(const std::string &name, long long micros) {
+      host_.push_back({name, micros});
+   }
+
+   // Device time of all phases whose name starts with prefix, in nanoseconds
+   cl_ulong device_time(const std::string &prefix) const {
+      cl_ulong total = 0;
+      for (auto &event : events_)
+         if (event.first.compare(0, prefix.size(), prefix) == 0)
+            total += event_duration(event.second);
+      return total;
+   }
+
+   // Print queued/submit/start/end of every phase relative to the first queued command
+   void print(const std::string &title) const {
+      std::vector<Phase> phases;
+      for (auto &event : events_) {
+         Phase phase;
+         phase.name = event.first;
+         cl_int err = read_phase(event.second, phase);
+         if (err != CL_SUCCESS) {
+            std::cout << " Profiling info not available for " << phase.name << std::endl;
+            continue;
+         }
+         phases.push_back(phase);
+      }
+
+      std::cout << "Profile of " << title << " (ms, relative to first queued command)" << std::endl;
+      if (!host_.empty()) {
+         for (auto &host : host_)
+            std::cout << "  host   " << std::left << std::setw(14) << host.name << std::right
+                      << std::fixed << std::setprecision(3) << std::setw(10) << host.micros / 1e3 << std::endl;
+      }
+      if (phases.empty())
+         return;
+
+      cl_ulong origin = phases[0].queued;
+      for (auto &phase : phases)
+         if (phase.queued < origin)
+            origin = phase.queued;
+
+      std::cout << "  device " << std::left << std::setw(14) << "phase" << std::right
+                << std::setw(10) << "queued" << std::setw(10) << "submit"
+                << std::setw(10) << "start" << std::setw(10) << "end"
+                << std::setw(10) << "wait" << std::setw(10) << "exec" << std::endl;
+      for (auto &phase : phases) {
+         std::cout << "         " << std::left << std::setw(14) << phase.name << std::right
+                   << std::fixed << std::setprecision(3)
+                   << std::setw(10) << (phase.queued - origin) / 1e6
+                   << std::setw(10) << (phase.submit - origin) / 1e6
+                   << std::setw(10) << (phase.start - origin) / 1e6
+                   << std::setw(10) << (phase.end - origin) / 1e6
+                   << std::setw(10) << (phase.start - phase.queued) / 1e6
+                   << std::setw(10) << (phase.end - phase.start) / 1e6 << std::endl;
+      }
+      std::cout.unsetf(std::ios_base::floatfield);
+      std::cout << std::setprecision(6);
+   }
+
+private:
+   std::vector<std::pair<std::string, cl_event>> events_;
+   std::vector<HostPhase> host_;
+};
+
+}
+
+#endif
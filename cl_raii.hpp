@@ -0,0 +1,241 @@
+//
+// Move-only owners of OpenCL objects, and per-device pools that reuse them.
+//
+
+#ifndef CL_RAII_HPP
+#define CL_RAII_HPP
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <CL/opencl.h>
+
+namespace clwrap {
+
+template <typename T> struct Release;
+template <> struct Release<cl_context> { static void apply(cl_context h) { clReleaseContext(h); } };
+template <> struct Release<cl_command_queue> { static void apply(cl_command_queue h) { clReleaseCommandQueue(h); } };
+template <> struct Release<cl_program> { static void apply(cl_program h) { clReleaseProgram(h); } };
+template <> struct Release<cl_kernel> { static void apply(cl_kernel h) { clReleaseKernel(h); } };
+template <> struct Release<cl_mem> { static void apply(cl_mem h) { clReleaseMemObject(h); } };
+template <> struct Release<cl_event> { static void apply(cl_event h) { clReleaseEvent(h); } };
+
+/**
+ * Sole owner of one OpenCL handle, released when the owner goes away, so
+ * early returns on error paths no longer leak. Moving transfers ownership;
+ * get() lends the raw handle to API calls.
+ */
+template <typename T>
+class Handle {
+public:
+   Handle() = default;
+   explicit Handle(T handle) : handle_(handle) {}
+   Handle(Handle &&other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+   Handle &operator=(Handle &&other) noexcept {
+      if (this != &other)
+         reset(other.release());
+      return *this;
+   }
+   Handle(const Handle &) = delete;
+   Handle &operator=(const Handle &) = delete;
+   ~Handle() { reset(); }
+
+   T get() const { return handle_; }
+   explicit operator bool() const { return handle_ != nullptr; }
+
+   // Give up ownership without releasing
+   T release() {
+      T handle = handle_;
+      handle_ = nullptr;
+      return handle;
+   }
+
+   void reset(T handle = nullptr) {
+      if (handle_ != nullptr)
+         Release<T>::apply(handle_);
+      handle_ = handle;
+   }
+
+private:
+   T handle_ = nullptr;
+};
+
+typedef Handle<cl_context> Context;
+typedef Handle<cl_command_queue> Queue;
+typedef Handle<cl_program> Program;
+typedef Handle<cl_kernel> Kernel;
+typedef Handle<cl_mem> Buffer;
+typedef Handle<cl_event> Event;
+
+inline Context create_context(cl_device_id device, cl_int *err) {
+   return Context(clCreateContext(nullptr, 1, &device, nullptr, nullptr, err));
+}
+
+inline Queue create_queue(cl_context context, cl_device_id device, cl_command_queue_properties properties,
+                          cl_int *err) {
+   return Queue(clCreateCommandQueue(context, device, properties, err));
+}
+
+inline Kernel create_kernel(cl_program program, const char *name, cl_int *err) {
+   return Kernel(clCreateKernel(program, name, err));
+}
+
+inline Buffer create_buffer(cl_context context, cl_mem_flags flags, size_t bytes, void *host, cl_int *err) {
+   return Buffer(clCreateBuffer(context, flags, bytes, host, err));
+}
+
+/**
+ * A handle borrowed from a pool: on destruction it goes back to the pool
+ * instead of being released. One built from a plain Handle has no pool
+ * and releases as usual, so pooled and unpooled objects mix freely.
+ */
+template <typename T>
+class Lease {
+public:
+   typedef std::function<void(Handle<T> &&)> Return;
+
+   Lease() = default;
+   explicit Lease(Handle<T> &&handle, Return give_back = Return())
+           : handle_(std::move(handle)), give_back_(std::move(give_back)) {}
+   Lease(Lease &&) = default;
+   Lease &operator=(Lease &&other) {
+      if (this != &other) {
+         reset();
+         handle_ = std::move(other.handle_);
+         give_back_ = std::move(other.give_back_);
+      }
+      return *this;
+   }
+   ~Lease() { reset(); }
+
+   T get() const { return handle_.get(); }
+   explicit operator bool() const { return static_cast<bool>(handle_); }
+
+   void reset() {
+      if (handle_ && give_back_)
+         give_back_(std::move(handle_));
+      handle_.reset();
+   }
+
+private:
+   Handle<T> handle_;
+   Return give_back_;
+};
+
+// Smallest size class holding bytes: 2^k, 1.25 * 2^k, 1.5 * 2^k or 1.75 * 2^k, so at most 25% is wasted
+inline size_t size_class(size_t bytes) {
+   size_t power = 64;
+   while (power * 2 <= bytes)
+      power *= 2;
+   for (size_t quarter = 0; quarter <= 4; ++quarter)
+      if (power + power / 4 * quarter >= bytes)
+         return power + power / 4 * quarter;
+   return power * 2;
+}
+
+struct PoolStats {
+   size_t created = 0;  // queues and buffers made by the driver
+   size_t reused = 0;   // requests served from the pool
+};
+
+/**
+ * The context of one device, created once, plus idle command queues (by
+ * properties) and buffers (by flags and size class) that earlier jobs
+ * handed back. Buffers may be larger than requested. Not thread-safe;
+ * leases must not outlive the pool.
+ */
+class DevicePool {
+public:
+   DevicePool(cl_device_id device, cl_int *err) : device_(device), context_(create_context(device, err)) {}
+
+   DevicePool(const DevicePool &) = delete;
+   DevicePool &operator=(const DevicePool &) = delete;
+
+   cl_device_id device() const { return device_; }
+   cl_context context() const { return context_.get(); }
+   const PoolStats &stats() const { return stats_; }
+
+   Lease<cl_command_queue> queue(cl_command_queue_properties properties, cl_int *err) {
+      std::vector<Queue> &idle = queues_[properties];
+      *err = CL_SUCCESS;
+      Queue queue;
+      if (!idle.empty()) {
+         queue = std::move(idle.back());
+         idle.pop_back();
+         stats_.reused++;
+      } else {
+         queue = create_queue(context_.get(), device_, properties, err);
+         if (*err != CL_SUCCESS)
+            return Lease<cl_command_queue>();
+         stats_.created++;
+      }
+      return Lease<cl_command_queue>(std::move(queue), [this, properties](Queue &&returned) {
+         // work still queued must not run into the next job
+         clFinish(returned.get());
+         queues_[properties].push_back(std::move(returned));
+      });
+   }
+
+   // A device-only buffer of at least bytes (no host pointer flags)
+   Lease<cl_mem> buffer(cl_mem_flags flags, size_t bytes, cl_int *err) {
+      const std::pair<cl_mem_flags, size_t> key(flags, size_class(bytes));
+      std::vector<Buffer> &idle = buffers_[key];
+      *err = CL_SUCCESS;
+      Buffer buffer;
+      if (!idle.empty()) {
+         buffer = std::move(idle.back());
+         idle.pop_back();
+         stats_.reused++;
+      } else {
+         buffer = create_buffer(context_.get(), flags, key.second, nullptr, err);
+         if (*err != CL_SUCCESS)
+            return Lease<cl_mem>();
+         stats_.created++;
+      }
+      return Lease<cl_mem>(std::move(buffer), [this, key](Buffer &&returned) {
+         buffers_[key].push_back(std::move(returned));
+      });
+   }
+
+private:
+   cl_device_id device_;
+   Context context_;
+   std::map<cl_command_queue_properties, std::vector<Queue>> queues_;
+   std::map<std::pair<cl_mem_flags, size_t>, std::vector<Buffer>> buffers_;
+   PoolStats stats_;
+};
+
+// One DevicePool per device, created on first use
+class Pools {
+public:
+   // nullptr if the device's context cannot be created
+   DevicePool *get(cl_device_id device, cl_int *err) {
+      auto found = pools_.find(device);
+      if (found != pools_.end()) {
+         *err = CL_SUCCESS;
+         return found->second.get();
+      }
+      std::unique_ptr<DevicePool> pool(new DevicePool(device, err));
+      if (*err != CL_SUCCESS)
+         return nullptr;
+      return (pools_[device] = std::move(pool)).get();
+   }
+
+   PoolStats stats() const {
+      PoolStats total;
+      for (auto &pool : pools_) {
+         total.created += pool.second->stats().created;
+         total.reused += pool.second->stats().reused;
+      }
+      return total;
+   }
+
+private:
+   std::map<cl_device_id, std::unique_ptr<DevicePool>> pools_;
+};
+
+}
+
+#endif
@@ -180,31 +180,34 @@ static void timer_start(const std::string &msg, const char unit = 'm') {
     }
 }
 
-static void timer_stop(char unit = 'm') {
+static long long timer_stop(char unit = 'm') {
     /*
      *  ' ': second
      *  'm': millisecond
      *  so on so forth
+     *  returns the elapsed time in the requested unit
      */
     auto entry = cxxtimer::timer_table.top();
+    long long elapsed;
     switch (unit) {
         case ' ':
-            entry->log<std::chrono::seconds>();
+            elapsed = entry->log<std::chrono::seconds>();
             break;
         case 'm':
-            entry->log<std::chrono::milliseconds>();
+            elapsed = entry->log<std::chrono::milliseconds>();
             break;
         case 'u':
-            entry->log<std::chrono::microseconds>();
+            elapsed = entry->log<std::chrono::microseconds>();
             break;
         case 'n':
-            entry->log<std::chrono::nanoseconds>();
+            elapsed = entry->log<std::chrono::nanoseconds>();
             break;
         default:
-            entry->log<std::chrono::minutes>();
+            elapsed = entry->log<std::chrono::minutes>();
             break;
     }
     cxxtimer::timer_table.pop();
     delete entry;
+    return elapsed;
 }
 #endif
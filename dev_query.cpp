@@ -4,6 +4,8 @@
 #include <vector>
 #include <string>
 #include <CL/cl.h>
+#include "vec_kernel.hpp"
+#include "bench_report.hpp"
 
 using namespace std;
 
@@ -38,22 +40,6 @@ const int NUM_OF_DEVICE_TYPES = sizeof(devices) / sizeof(devices[0]);
 
 
 
-// OpenCL kernel. Each work item takes care of one element of c
-const char* kernelSource = "\n" \
-"#pragma OPENCL EXTENSION cl_khr_fp64 : enable                    \n" \
-"__kernel void vecAdd(  __global double *a,                       \n" \
-"                       __global double *b,                       \n" \
-"                       __global double *c,                       \n" \
-"                       const unsigned int n)                    \n" \
-"{                                                               \n" \
-"    //Get our global thread ID                                  \n" \
-"    int id = get_global_id(0);                                  \n" \
-"                                                                \n" \
-"    //Make sure we do not go out of bounds                      \n" \
-"    if (id < n)                                                 \n" \
-"        c[id] = a[id] + b[id];                                  \n" \
-"}                                                               \n" \
-"\n";
 void printInfo() {
    // Discover and initialize the platforms
    cl_int err = CL_SUCCESS;
@@ -153,6 +139,10 @@ void printInfo() {
             OCLBASIC_PRINT_NUMERIC_PROPERTY(CL_DEVICE_ERROR_CORRECTION_SUPPORT, cl_bool);
             OCLBASIC_PRINT_NUMERIC_PROPERTY(CL_DEVICE_HOST_UNIFIED_MEMORY, cl_bool);
             OCLBASIC_PRINT_TEXT_PROPERTY(CL_DEVICE_EXTENSIONS);
+            // vecAdd element types the typed kernel generator can build here
+            std::cout << " vecAdd element types: float int complex"
+                      << (clkernels::supported<double>(device) ? " double" : "")
+                      << (clkernels::supported<clkernels::Half>(device) ? " half" : "") << std::endl;
             OCLBASIC_PRINT_NUMERIC_PROPERTY(CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT, cl_uint);
             OCLBASIC_PRINT_NUMERIC_PROPERTY(CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG, cl_uint);
             OCLBASIC_PRINT_NUMERIC_PROPERTY(CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, cl_uint);
@@ -168,8 +158,54 @@ void printInfo() {
    }
    delete[] platforms;
 }
-int main()
+// Every device of every platform, in the machine-readable form vec_add attaches to its results
+int writeDeviceList(const std::string &json_path, const std::string &csv_path) {
+   cl_uint num_of_platforms = 0;
+   if (clGetPlatformIDs(0, nullptr, &num_of_platforms) != CL_SUCCESS)
+      num_of_platforms = 0;
+   std::vector<cl_platform_id> platforms(num_of_platforms);
+   if (num_of_platforms > 0)
+      clGetPlatformIDs(num_of_platforms, platforms.data(), nullptr);
+   std::vector<benchreport::DeviceInfo> infos;
+   for (cl_platform_id platform : platforms) {
+      cl_uint count = 0;
+      if (clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &count) != CL_SUCCESS || count == 0)
+         continue;
+      std::vector<cl_device_id> ids(count);
+      clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, count, ids.data(), nullptr);
+      for (cl_device_id device : ids)
+         infos.push_back(benchreport::describe(device));
+   }
+   int status = 0;
+   if (!json_path.empty() && !benchreport::write_devices_json(json_path, "dev_query", infos)) {
+      std::cout << "Cannot write " << json_path << std::endl;
+      status = -1;
+   }
+   if (!csv_path.empty() && !benchreport::write_devices_csv(csv_path, infos)) {
+      std::cout << "Cannot write " << csv_path << std::endl;
+      status = -1;
+   }
+   return status;
+}
+
+int main(int argc, char* argv[])
 {
+   // --json PATH / --csv PATH: also write the device list to a file
+   std::string json_path, csv_path;
+   for (int arg = 1; arg < argc; ++arg) {
+      std::string option(argv[arg]);
+      if (option == "--json" && arg + 1 < argc) {
+         json_path = argv[++arg];
+      } else if (option == "--csv" && arg + 1 < argc) {
+         csv_path = argv[++arg];
+      } else {
+         std::cout << "Unknown option " << option << std::endl;
+         std::cout << "Usage: " << argv[0] << " [--json PATH] [--csv PATH]" << std::endl;
+         return -1;
+      }
+   }
    printInfo();
+   if (!json_path.empty() || !csv_path.empty())
+      return writeDeviceList(json_path, csv_path);
    return 0;
 }
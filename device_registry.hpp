@@ -0,0 +1,151 @@
+//
+// Every OpenCL device of every platform, and selection of devices by pattern.
+//
+
+#ifndef DEVICE_REGISTRY_HPP
+#define DEVICE_REGISTRY_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+#include "program_cache.hpp"
+
+namespace cldevices {
+
+struct Entry {
+   cl_platform_id platform = nullptr;
+   cl_device_id device = nullptr;
+   unsigned index = 0;           // position among all devices
+   unsigned platform_index = 0;
+   unsigned device_index = 0;    // position within its platform
+   cl_device_type type = 0;
+   std::string name;
+   std::string vendor;
+   std::string platform_name;
+
+   // "name [platform:device]", unique even for identical boards
+   std::string label() const {
+      return name + " [" + std::to_string(platform_index) + ":" + std::to_string(device_index) + "]";
+   }
+};
+
+inline std::string lower(std::string text) {
+   std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+   return text;
+}
+
+inline const char *type_name(cl_device_type type) {
+   if (type & CL_DEVICE_TYPE_GPU) return "gpu";
+   if (type & CL_DEVICE_TYPE_CPU) return "cpu";
+   if (type & CL_DEVICE_TYPE_ACCELERATOR) return "accelerator";
+   return "other";
+}
+
+/**
+ * Enumerates all platforms and their devices once, in ICD order. Devices
+ * are selected with a comma separated list of terms, each of which adds
+ * every device it matches:
+ *   all                  every device
+ *   gpu|cpu|accelerator  by CL_DEVICE_TYPE
+ *   N                    by position in list()
+ *   P:D                  device D of platform P
+ *   anything else        case-insensitive substring of device name, vendor or platform name
+ */
+class Registry {
+public:
+   Registry() {
+      cl_uint num_platforms = 0;
+      if (clGetPlatformIDs(0, nullptr, &num_platforms) != CL_SUCCESS || num_platforms == 0)
+         return;
+      std::vector<cl_platform_id> platforms(num_platforms);
+      clGetPlatformIDs(num_platforms, platforms.data(), nullptr);
+      for (cl_uint p = 0; p < num_platforms; ++p) {
+         cl_uint num_devices = 0;
+         if (clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, 0, nullptr, &num_devices) != CL_SUCCESS)
+            continue;
+         std::vector<cl_device_id> devices(num_devices);
+         clGetDeviceIDs(platforms[p], CL_DEVICE_TYPE_ALL, num_devices, devices.data(), nullptr);
+         const std::string platform_name = clcache::platform_string(platforms[p], CL_PLATFORM_NAME);
+         for (cl_uint d = 0; d < num_devices; ++d) {
+            Entry entry;
+            entry.platform = platforms[p];
+            entry.device = devices[d];
+            entry.index = static_cast<unsigned>(entries_.size());
+            entry.platform_index = p;
+            entry.device_index = d;
+            clGetDeviceInfo(devices[d], CL_DEVICE_TYPE, sizeof(entry.type), &entry.type, nullptr);
+            entry.name = clcache::device_string(devices[d], CL_DEVICE_NAME);
+            entry.vendor = clcache::device_string(devices[d], CL_DEVICE_VENDOR);
+            entry.platform_name = platform_name;
+            entries_.push_back(entry);
+         }
+      }
+   }
+
+   const std::vector<Entry> &list() const { return entries_; }
+
+   // Matching devices in registry order, each at most once
+   std::vector<Entry> select(const std::string &pattern) const {
+      std::vector<bool> chosen(entries_.size(), false);
+      std::istringstream terms(pattern);
+      std::string term;
+      while (std::getline(terms, term, ','))
+         for (const Entry &entry : entries_)
+            if (matches(entry, lower(term)))
+               chosen[entry.index] = true;
+      std::vector<Entry> selected;
+      for (const Entry &entry : entries_)
+         if (chosen[entry.index])
+            selected.push_back(entry);
+      return selected;
+   }
+
+   void print() const {
+      for (const Entry &entry : entries_)
+         std::cout << " [" << entry.index << "] " << entry.platform_index << ":" << entry.device_index << " "
+                   << type_name(entry.type) << " " << entry.name << " (" << entry.vendor << ", "
+                   << entry.platform_name << ")" << std::endl;
+   }
+
+private:
+   static bool is_number(const std::string &text) {
+      return !text.empty() && std::all_of(text.begin(), text.end(), [](unsigned char c) { return std::isdigit(c); });
+   }
+
+   static bool matches(const Entry &entry, const std::string &term) {
+      if (term.empty())
+         return false;
+      if (term == "all")
+         return true;
+      if (term == "gpu" || term == "cpu" || term == "accelerator")
+         return term == type_name(entry.type);
+      if (is_number(term))
+         return entry.index == strtoul(term.c_str(), nullptr, 10);
+      size_t colon = term.find(':');
+      if (colon != std::string::npos && is_number(term.substr(0, colon)) && is_number(term.substr(colon + 1)))
+         return entry.platform_index == strtoul(term.substr(0, colon).c_str(), nullptr, 10) &&
+                entry.device_index == strtoul(term.substr(colon + 1).c_str(), nullptr, 10);
+      return lower(entry.name).find(term) != std::string::npos ||
+             lower(entry.vendor).find(term) != std::string::npos ||
+             lower(entry.platform_name).find(term) != std::string::npos;
+   }
+
+   std::vector<Entry> entries_;
+};
+
+// Just the device IDs of entries
+inline std::vector<cl_device_id> device_ids(const std::vector<Entry> &entries) {
+   std::vector<cl_device_id> ids;
+   for (const Entry &entry : entries)
+      ids.push_back(entry.device);
+   return ids;
+}
+
+}
+
+#endif
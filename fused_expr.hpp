@@ -0,0 +1,270 @@
+//
+// Lazily evaluated elementwise expressions over device vectors, fused into one kernel.
+//
+
+#ifndef FUSED_EXPR_HPP
+#define FUSED_EXPR_HPP
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include <CL/opencl.h>
+#include "program_cache.hpp"
+
+namespace clexpr {
+
+class Engine;
+class Vector;
+
+// Leaves of one expression in kernel argument order; the same buffer used twice is passed once
+struct Args {
+   std::vector<cl_mem> vectors;
+   std::vector<float> scalars;
+
+   std::string vector(cl_mem buffer) {
+      for (size_t v = 0; v < vectors.size(); ++v)
+         if (vectors[v] == buffer)
+            return "v" + std::to_string(v) + "[i]";
+      vectors.push_back(buffer);
+      return "v" + std::to_string(vectors.size() - 1) + "[i]";
+   }
+
+   // Scalars are kernel arguments, so changing a value never rebuilds the kernel
+   std::string scalar(float value) {
+      scalars.push_back(value);
+      return "s" + std::to_string(scalars.size() - 1);
+   }
+};
+
+// CRTP base of every expression node
+template <typename E>
+struct Expr {
+   const E &self() const { return static_cast<const E &>(*this); }
+};
+
+struct Scalar : Expr<Scalar> {
+   explicit Scalar(float value) : value(value) {}
+   std::string code(Args &args) const { return args.scalar(value); }
+   bool fits(size_t) const { return true; }
+   float value;
+};
+
+// Vectors are held by reference inside expressions, everything else by value
+template <typename E>
+struct Operand {
+   typedef E type;
+};
+
+template <>
+struct Operand<Vector> {
+   typedef const Vector &type;
+};
+
+template <char Op, typename L, typename R>
+struct Binary : Expr<Binary<Op, L, R>> {
+   Binary(const L &left, const R &right) : left(left), right(right) {}
+   std::string code(Args &args) const {
+      std::string lhs = left.code(args);
+      return "(" + lhs + " " + Op + " " + right.code(args) + ")";
+   }
+   // every vector operand has exactly n elements
+   bool fits(size_t n) const { return left.fits(n) && right.fits(n); }
+   typename Operand<L>::type left;
+   typename Operand<R>::type right;
+};
+
+#define CLEXPR_BINARY_OPERATOR(OP, CH)                                                  \
+template <typename L, typename R>                                                       \
+Binary<CH, L, R> operator OP(const Expr<L> &left, const Expr<R> &right) {               \
+   return Binary<CH, L, R>(left.self(), right.self());                                  \
+}                                                                                       \
+template <typename L>                                                                   \
+Binary<CH, L, Scalar> operator OP(const Expr<L> &left, float right) {                   \
+   return Binary<CH, L, Scalar>(left.self(), Scalar(right));                            \
+}                                                                                       \
+template <typename R>                                                                   \
+Binary<CH, Scalar, R> operator OP(float left, const Expr<R> &right) {                   \
+   return Binary<CH, Scalar, R>(Scalar(left), right.self());                            \
+}
+
+CLEXPR_BINARY_OPERATOR(+, '+')
+CLEXPR_BINARY_OPERATOR(-, '-')
+CLEXPR_BINARY_OPERATOR(*, '*')
+CLEXPR_BINARY_OPERATOR(/, '/')
+
+#undef CLEXPR_BINARY_OPERATOR
+
+/**
+ * A float vector in device memory. Arithmetic on vectors only builds an
+ * expression tree; assigning the tree to a vector generates (or reuses)
+ * one kernel for the whole expression and launches it, so intermediate
+ * results never touch global memory.
+ */
+class Vector : public Expr<Vector> {
+public:
+   Vector(Engine &engine, cl_mem buffer, size_t size) : engine_(&engine), buffer_(buffer), size_(size) {}
+   Vector(Vector &&other) : engine_(other.engine_), buffer_(other.buffer_), size_(other.size_) {
+      other.buffer_ = nullptr;
+   }
+   Vector(const Vector &) = delete;
+   ~Vector() {
+      if (buffer_ != nullptr) clReleaseMemObject(buffer_);
+   }
+
+   // Evaluate on assignment
+   template <typename E>
+   Vector &operator=(const Expr<E> &expr);
+   Vector &operator=(const Vector &other);
+
+   std::string code(Args &args) const { return args.vector(buffer_); }
+   size_t size() const { return size_; }
+   bool fits(size_t n) const { return size_ == n; }
+   cl_mem buffer() const { return buffer_; }
+
+   cl_int write(const float *host);
+   cl_int read(float *host) const;
+
+private:
+   Engine *engine_;
+   cl_mem buffer_;
+   size_t size_;
+};
+
+/**
+ * Creates device vectors and evaluates expressions on one queue. Fused
+ * kernels are cached by expression signature (the generated expression
+ * plus its argument counts); their programs also go through the on-disk
+ * program cache. The first failure is kept in error().
+ */
+class Engine {
+public:
+   Engine(cl_context context, cl_device_id device, cl_command_queue queue, clcache::ProgramCache &program_cache)
+           : context_(context), device_(device), queue_(queue), program_cache_(program_cache) {}
+
+   Engine(const Engine &) = delete;
+   Engine &operator=(const Engine &) = delete;
+
+   ~Engine() {
+      for (auto &entry : kernels_) {
+         clReleaseKernel(entry.second.second);
+         clReleaseProgram(entry.second.first);
+      }
+   }
+
+   // Uninitialised device vector of n floats, or copied from host when given
+   Vector vector(size_t n, const float *host = nullptr) {
+      cl_int err;
+      cl_mem buffer = clCreateBuffer(context_, CL_MEM_READ_WRITE, std::max<size_t>(n, 1) * sizeof(float),
+                                     nullptr, &err);
+      record(err);
+      Vector vector(*this, err == CL_SUCCESS ? buffer : nullptr, n);
+      if (host != nullptr && err == CL_SUCCESS)
+         record(vector.write(host));
+      return vector;
+   }
+
+   template <typename E>
+   cl_int evaluate(Vector &out, const Expr<E> &expr) {
+      // a shorter operand would be read past its end
+      if (!expr.self().fits(out.size()))
+         return record(CL_INVALID_VALUE);
+      Args args;
+      const std::string body = expr.self().code(args);
+      const std::string signature = body + " " + std::to_string(args.vectors.size()) + " " +
+                                    std::to_string(args.scalars.size());
+      cl_int err = CL_SUCCESS;
+      cl_kernel kernel = kernel_for(signature, body, args, &err);
+      if (kernel == nullptr)
+         return record(err);
+
+      cl_mem out_buffer = out.buffer();
+      const unsigned int n = static_cast<unsigned int>(out.size());
+      err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &out_buffer);
+      err |= clSetKernelArg(kernel, 1, sizeof(unsigned int), &n);
+      cl_uint index = 2;
+      for (cl_mem &buffer : args.vectors)
+         err |= clSetKernelArg(kernel, index++, sizeof(cl_mem), &buffer);
+      for (float &value : args.scalars)
+         err |= clSetKernelArg(kernel, index++, sizeof(float), &value);
+      if (err != CL_SUCCESS)
+         return record(err);
+      size_t global_size = std::max<size_t>(n, 1);
+      ++launches_;
+      return record(clEnqueueNDRangeKernel(queue_, kernel, 1, nullptr, &global_size, nullptr, 0, nullptr, nullptr));
+   }
+
+   cl_command_queue queue() const { return queue_; }
+   cl_int error() const { return error_; }
+   size_t kernels() const { return kernels_.size(); }
+   size_t launches() const { return launches_; }
+
+private:
+   cl_int record(cl_int err) {
+      if (error_ == CL_SUCCESS)
+         error_ = err;
+      return err;
+   }
+
+   cl_kernel kernel_for(const std::string &signature, const std::string &body, const Args &args, cl_int *err) {
+      auto cached = kernels_.find(signature);
+      if (cached != kernels_.end())
+         return cached->second.second;
+
+      std::string source = "__kernel void fused(__global float *out, const unsigned int n";
+      for (size_t v = 0; v < args.vectors.size(); ++v)
+         source += ",\n                    __global const float *v" + std::to_string(v);
+      for (size_t s = 0; s < args.scalars.size(); ++s)
+         source += ",\n                    const float s" + std::to_string(s);
+      source += ")\n"
+                "{\n"
+                "    size_t i = get_global_id(0);\n"
+                "    if (i < n)\n"
+                "        out[i] = " + body + ";\n"
+                "}\n";
+      cl_program program = program_cache_.build(context_, device_, source.c_str(), "", err);
+      if (program == nullptr)
+         return nullptr;
+      cl_kernel kernel = clCreateKernel(program, "fused", err);
+      if (kernel == nullptr) {
+         clReleaseProgram(program);
+         return nullptr;
+      }
+      kernels_[signature] = std::make_pair(program, kernel);
+      return kernel;
+   }
+
+   cl_context context_;
+   cl_device_id device_;
+   cl_command_queue queue_;
+   clcache::ProgramCache &program_cache_;
+   std::map<std::string, std::pair<cl_program, cl_kernel>> kernels_;
+   size_t launches_ = 0;
+   cl_int error_ = CL_SUCCESS;
+};
+
+template <typename E>
+Vector &Vector::operator=(const Expr<E> &expr) {
+   engine_->evaluate(*this, expr);
+   return *this;
+}
+
+inline Vector &Vector::operator=(const Vector &other) {
+   engine_->evaluate(*this, static_cast<const Expr<Vector> &>(other));
+   return *this;
+}
+
+inline cl_int Vector::write(const float *host) {
+   return clEnqueueWriteBuffer(engine_->queue(), buffer_, CL_TRUE, 0, size_ * sizeof(float), host,
+                               0, nullptr, nullptr);
+}
+
+inline cl_int Vector::read(float *host) const {
+   return clEnqueueReadBuffer(engine_->queue(), buffer_, CL_TRUE, 0, size_ * sizeof(float), host,
+                              0, nullptr, nullptr);
+}
+
+}
+
+#endif
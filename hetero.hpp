@@ -0,0 +1,147 @@
+//
+// Concurrent vector addition split across several OpenCL devices.
+//
+
+#ifndef HETERO_HPP
+#define HETERO_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <CL/opencl.h>
+#include "cl_raii.hpp"
+#include "kernel_gen.hpp"
+
+namespace clhetero {
+
+/**
+ * One device taking part in a heterogeneous run. The context, queue,
+ * program and kernel are created by the caller; buffers are sized to the
+ * slice the device receives from partition(). All of them are released
+ * with the worker.
+ */
+struct Worker {
+   std::string name;
+   cl_device_id device = nullptr;
+   clwrap::Context context;
+   clwrap::Queue queue;
+   clwrap::Program program;
+   clwrap::Kernel kernel;
+   clkernels::Variant variant;  // the variant kernel was built from
+   clwrap::Buffer d_a, d_b, d_c;
+   double throughput = 0;  // elements per millisecond measured by probe()
+   size_t offset = 0;
+   size_t count = 0;
+   double ms = 0;          // wall time of the last run
+   cl_int err = CL_SUCCESS;
+};
+
+inline void release_buffers(Worker &worker) {
+   worker.d_a.reset();
+   worker.d_b.reset();
+   worker.d_c.reset();
+}
+
+// (Re)create the worker's buffers for count elements
+inline cl_int allocate(Worker &worker, size_t count) {
+   release_buffers(worker);
+   cl_int err = CL_SUCCESS;
+   const size_t bytes = std::max<size_t>(count, 1) * sizeof(float);
+   worker.d_a = clwrap::create_buffer(worker.context.get(), CL_MEM_READ_ONLY, bytes, nullptr, &err);
+   if (err != CL_SUCCESS) return err;
+   worker.d_b = clwrap::create_buffer(worker.context.get(), CL_MEM_READ_ONLY, bytes, nullptr, &err);
+   if (err != CL_SUCCESS) return err;
+   worker.d_c = clwrap::create_buffer(worker.context.get(), CL_MEM_WRITE_ONLY, bytes, nullptr, &err);
+   return err;
+}
+
+// Upload, add and download elements [offset, offset + count) with the worker's buffers
+inline cl_int run_slice(Worker &worker, const float *a, const float *b, float *c,
+                        size_t offset, size_t count, size_t local_size) {
+   if (count == 0)
+      return CL_SUCCESS;
+   const size_t bytes = count * sizeof(float);
+   const unsigned int elements = static_cast<unsigned int>(count);
+   // a local size of 0 leaves the work-group size to the runtime
+   size_t global_size = worker.variant.global_size(count, local_size);
+   cl_command_queue queue = worker.queue.get();
+   cl_mem buffers[] = {worker.d_a.get(), worker.d_b.get(), worker.d_c.get()};
+   cl_int err = clEnqueueWriteBuffer(queue, buffers[0], CL_FALSE, 0, bytes, a + offset, 0, nullptr, nullptr);
+   err |= clEnqueueWriteBuffer(queue, buffers[1], CL_FALSE, 0, bytes, b + offset, 0, nullptr, nullptr);
+   for (cl_uint arg = 0; arg < 3; ++arg)
+      err |= clSetKernelArg(worker.kernel.get(), arg, sizeof(cl_mem), &buffers[arg]);
+   err |= clSetKernelArg(worker.kernel.get(), 3, sizeof(unsigned int), &elements);
+   if (err != CL_SUCCESS)
+      return err;
+   err = clEnqueueNDRangeKernel(queue, worker.kernel.get(), 1, nullptr, &global_size,
+                                local_size ? &local_size : nullptr, 0, nullptr, nullptr);
+   if (err != CL_SUCCESS)
+      return err;
+   return clEnqueueReadBuffer(queue, buffers[2], CL_TRUE, 0, bytes, c + offset, 0, nullptr, nullptr);
+}
+
+// Measure end-to-end throughput of each device alone on the first probe_count elements
+inline void probe(std::vector<Worker> &workers, const float *a, const float *b, float *c,
+                  size_t probe_count, size_t local_size) {
+   for (auto &worker : workers) {
+      worker.err = allocate(worker, probe_count);
+      // the first pass pays for first-use costs and is not timed
+      if (worker.err == CL_SUCCESS)
+         worker.err = run_slice(worker, a, b, c, 0, probe_count, local_size);
+      auto begin = std::chrono::steady_clock::now();
+      if (worker.err == CL_SUCCESS)
+         worker.err = run_slice(worker, a, b, c, 0, probe_count, local_size);
+      double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+      worker.throughput = worker.err == CL_SUCCESS ? probe_count / std::max(ms, 1e-3) : 0;
+      release_buffers(worker);
+   }
+}
+
+// Split n elements in proportion to throughput, in multiples of granularity; false if no device is usable
+inline bool partition(std::vector<Worker> &workers, size_t n, size_t granularity) {
+   double total = 0;
+   for (auto &worker : workers)
+      total += worker.throughput;
+   if (total <= 0)
+      return false;
+   size_t offset = 0;
+   Worker *last = nullptr;
+   for (auto &worker : workers) {
+      worker.offset = offset;
+      worker.count = 0;
+      if (worker.throughput <= 0)
+         continue;
+      worker.count = static_cast<size_t>(n * (worker.throughput / total)) / granularity * granularity;
+      worker.count = std::min(worker.count, n - offset);
+      offset += worker.count;
+      last = &worker;
+   }
+   // rounding leftovers go to the last usable device
+   last->count += n - offset;
+   return true;
+}
+
+// Run every worker's slice at the same time, one host thread per device
+inline cl_int run_concurrent(std::vector<Worker> &workers, const float *a, const float *b, float *c,
+                             size_t local_size) {
+   std::vector<std::thread> threads;
+   for (auto &worker : workers) {
+      threads.emplace_back([&worker, a, b, c, local_size]() {
+         auto begin = std::chrono::steady_clock::now();
+         worker.err = run_slice(worker, a, b, c, worker.offset, worker.count, local_size);
+         worker.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+      });
+   }
+   for (auto &thread : threads)
+      thread.join();
+   for (auto &worker : workers)
+      if (worker.err != CL_SUCCESS)
+         return worker.err;
+   return CL_SUCCESS;
+}
+
+}
+
+#endif
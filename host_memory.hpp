@@ -0,0 +1,95 @@
+//
+// Host memory helpers for buffers shared with OpenCL devices.
+//
+
+#ifndef HOST_MEMORY_HPP
+#define HOST_MEMORY_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include <CL/opencl.h>
+#include "cl_raii.hpp"
+
+namespace hostmem {
+
+// Page alignment satisfies CL_DEVICE_MEM_BASE_ADDR_ALIGN of every device we run on and
+// is what the Intel runtimes require before they skip the copy of a CL_MEM_USE_HOST_PTR buffer
+const size_t page_alignment = 4096;
+
+inline size_t round_up(size_t bytes, size_t alignment) {
+   return (bytes + alignment - 1) / alignment * alignment;
+}
+
+// Allocate bytes rounded up to a whole number of alignment units. Returns nullptr on failure.
+inline void *aligned_malloc(size_t bytes, size_t alignment = page_alignment) {
+   void *pointer = nullptr;
+#ifdef _WIN32
+   pointer = _aligned_malloc(round_up(bytes, alignment), alignment);
+#else
+   if (posix_memalign(&pointer, alignment, round_up(bytes, alignment)) != 0)
+      pointer = nullptr;
+#endif
+   return pointer;
+}
+
+inline void aligned_free(void *pointer) {
+#ifdef _WIN32
+   _aligned_free(pointer);
+#else
+   free(pointer);
+#endif
+}
+
+// Where transfers read and write host data
+enum class Policy {
+   pageable,  // plain process memory; discrete GPU drivers stage it through their own pinned bounce buffer
+   pinned     // driver-pinned staging from a mapped CL_MEM_ALLOC_HOST_PTR buffer, DMA-able as is
+};
+
+inline Policy parse_policy(const std::string &name) {
+   return name == "pinned" ? Policy::pinned : Policy::pageable;
+}
+
+/**
+ * Page-locked host memory the driver can DMA from directly: a
+ * CL_MEM_ALLOC_HOST_PTR buffer mapped once and kept mapped, so its pointer
+ * is ordinary host memory to fill and to pass to clEnqueueWrite/ReadBuffer
+ * on the same context. Unmapped on destruction; queue must outlive it.
+ */
+class PinnedBuffer {
+public:
+   PinnedBuffer(cl_context context, cl_command_queue queue, size_t bytes, cl_int *err)
+           : queue_(queue), bytes_(bytes) {
+      buffer_ = clwrap::create_buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, bytes, nullptr, err);
+      if (*err == CL_SUCCESS)
+         data_ = clEnqueueMapBuffer(queue, buffer_.get(), CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes,
+                                    0, nullptr, nullptr, err);
+   }
+
+   PinnedBuffer(const PinnedBuffer &) = delete;
+   PinnedBuffer &operator=(const PinnedBuffer &) = delete;
+
+   ~PinnedBuffer() {
+      if (data_ != nullptr) {
+         clEnqueueUnmapMemObject(queue_, buffer_.get(), data_, 0, nullptr, nullptr);
+         clFinish(queue_);
+      }
+   }
+
+   void *data() const { return data_; }
+   size_t bytes() const { return bytes_; }
+
+private:
+   cl_command_queue queue_;
+   size_t bytes_;
+   clwrap::Buffer buffer_;
+   void *data_ = nullptr;
+};
+
+}
+
+#endif
@@ -0,0 +1,182 @@
+//
+// SIMD inner loops of the host vector addition.
+//
+
+#ifndef HOST_SIMD_HPP
+#define HOST_SIMD_HPP
+
+#include <cstddef>
+
+// GCC and Clang on x86 compile every loop with a target attribute and pick one at run time, so a default
+// build still uses AVX2 or AVX-512 where the CPU has it; other compilers get the loops the build flags allow
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HOSTSIMD_DISPATCH
+#define HOSTSIMD_SSE2
+#define HOSTSIMD_AVX2
+#define HOSTSIMD_AVX512
+#define HOSTSIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#define HOSTSIMD_SSE2
+#endif
+#if defined(__AVX2__)
+#define HOSTSIMD_AVX2
+#endif
+#if defined(__AVX512F__)
+#define HOSTSIMD_AVX512
+#endif
+#define HOSTSIMD_TARGET(isa)
+#endif
+
+namespace hostsimd {
+
+enum class Level { scalar, sse2, avx2, avx512 };
+
+// Widest loop this CPU can run, detected once
+inline Level level() {
+   static const Level detected = []() {
+#if defined(HOSTSIMD_DISPATCH)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx512f")) return Level::avx512;
+      if (__builtin_cpu_supports("avx2")) return Level::avx2;
+      if (__builtin_cpu_supports("sse2")) return Level::sse2;
+      return Level::scalar;
+#elif defined(HOSTSIMD_AVX512)
+      return Level::avx512;
+#elif defined(HOSTSIMD_AVX2)
+      return Level::avx2;
+#elif defined(HOSTSIMD_SSE2)
+      return Level::sse2;
+#else
+      return Level::scalar;
+#endif
+   }();
+   return detected;
+}
+
+// Instruction set of the loops add() and first_difference() run
+inline const char *isa() {
+   switch (level()) {
+      case Level::avx512: return "AVX-512";
+      case Level::avx2: return "AVX2";
+      case Level::sse2: return "SSE2";
+      default: return "scalar";
+   }
+}
+
+// The vector loops stop at the last full vector and return where they stopped; the caller finishes the tail
+#if defined(HOSTSIMD_AVX512)
+HOSTSIMD_TARGET("avx512f")
+inline size_t add_avx512(const float *a, const float *b, float *c, size_t i, size_t end) {
+   for (; i + 16 <= end; i += 16)
+      _mm512_storeu_ps(c + i, _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+   return i;
+}
+
+HOSTSIMD_TARGET("avx512f")
+inline size_t equal_avx512(const float *a, const float *b, const float *c, size_t i, size_t end) {
+   for (; i + 16 <= end; i += 16) {
+      __m512 sum = _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+      if (_mm512_cmp_ps_mask(sum, _mm512_loadu_ps(c + i), _CMP_EQ_OQ) != 0xffff)
+         break;
+   }
+   return i;
+}
+#endif
+
+#if defined(HOSTSIMD_AVX2)
+HOSTSIMD_TARGET("avx2")
+inline size_t add_avx2(const float *a, const float *b, float *c, size_t i, size_t end) {
+   for (; i + 8 <= end; i += 8)
+      _mm256_storeu_ps(c + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+   return i;
+}
+
+HOSTSIMD_TARGET("avx2")
+inline size_t equal_avx2(const float *a, const float *b, const float *c, size_t i, size_t end) {
+   for (; i + 8 <= end; i += 8) {
+      __m256 sum = _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+      if (_mm256_movemask_ps(_mm256_cmp_ps(sum, _mm256_loadu_ps(c + i), _CMP_EQ_OQ)) != 0xff)
+         break;
+   }
+   return i;
+}
+#endif
+
+#if defined(HOSTSIMD_SSE2)
+HOSTSIMD_TARGET("sse2")
+inline size_t add_sse2(const float *a, const float *b, float *c, size_t i, size_t end) {
+   for (; i + 4 <= end; i += 4)
+      _mm_storeu_ps(c + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+   return i;
+}
+
+HOSTSIMD_TARGET("sse2")
+inline size_t equal_sse2(const float *a, const float *b, const float *c, size_t i, size_t end) {
+   for (; i + 4 <= end; i += 4) {
+      __m128 sum = _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+      if (_mm_movemask_ps(_mm_cmpeq_ps(sum, _mm_loadu_ps(c + i))) != 0xf)
+         break;
+   }
+   return i;
+}
+#endif
+
+// c[i] = a[i] + b[i] for i in [begin, end); unaligned loads, so any slice works
+inline void add(const float *a, const float *b, float *c, size_t begin, size_t end) {
+   size_t i = begin;
+   switch (level()) {
+#if defined(HOSTSIMD_AVX512)
+      case Level::avx512: i = add_avx512(a, b, c, i, end); break;
+#endif
+#if defined(HOSTSIMD_AVX2)
+      case Level::avx2: i = add_avx2(a, b, c, i, end); break;
+#endif
+#if defined(HOSTSIMD_SSE2)
+      case Level::sse2: i = add_sse2(a, b, c, i, end); break;
+#endif
+      default: break;
+   }
+   for (; i < end; ++i)
+      c[i] = a[i] + b[i];
+}
+
+// First index in [begin, end) where c does not compare equal to a + b, or end if there is none
+inline size_t first_difference(const float *a, const float *b, const float *c, size_t begin, size_t end) {
+   size_t i = begin;
+   switch (level()) {
+#if defined(HOSTSIMD_AVX512)
+      case Level::avx512: i = equal_avx512(a, b, c, i, end); break;
+#endif
+#if defined(HOSTSIMD_AVX2)
+      case Level::avx2: i = equal_avx2(a, b, c, i, end); break;
+#endif
+#if defined(HOSTSIMD_SSE2)
+      case Level::sse2: i = equal_sse2(a, b, c, i, end); break;
+#endif
+      default: break;
+   }
+   // the scalar loop pins down the element inside the vector that differed
+   for (; i < end; ++i) {
+      float expected = a[i] + b[i];
+      if (!(expected == c[i]))
+         return i;
+   }
+   return end;
+}
+
+}
+
+#undef HOSTSIMD_DISPATCH
+#undef HOSTSIMD_SSE2
+#undef HOSTSIMD_AVX2
+#undef HOSTSIMD_AVX512
+#undef HOSTSIMD_TARGET
+
+#endif
@@ -0,0 +1,104 @@
+//
+// Element-wise verification of c = a + b against a multithreaded SIMD host reference.
+//
+
+#ifndef HOST_VERIFY_HPP
+#define HOST_VERIFY_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include "host_simd.hpp"
+#include "thread_pool.hpp"
+
+namespace hostverify {
+
+struct Mismatch {
+   size_t index;
+   float expected;
+   float actual;
+   uint32_t ulps;
+};
+
+struct Report {
+   size_t checked = 0;
+   size_t mismatches = 0;         // elements further than the tolerance from the reference
+   uint32_t max_ulps = 0;         // largest distance seen, within tolerance or not
+   std::vector<Mismatch> first;   // lowest indices among the mismatches
+   double ms = 0;
+};
+
+// Distance in units in the last place; floats are mapped onto a monotonic integer line
+inline uint32_t ulp_distance(float x, float y) {
+   if (std::isnan(x) || std::isnan(y))
+      return std::isnan(x) && std::isnan(y) ? 0 : UINT32_MAX;
+   int32_t ix, iy;
+   std::memcpy(&ix, &x, sizeof(ix));
+   std::memcpy(&iy, &y, sizeof(iy));
+   int64_t ox = ix < 0 ? static_cast<int64_t>(INT32_MIN) - ix : ix;
+   int64_t oy = iy < 0 ? static_cast<int64_t>(INT32_MIN) - iy : iy;
+   int64_t distance = ox > oy ? ox - oy : oy - ox;
+   return distance > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(distance);
+}
+
+/**
+ * Compare c with a + b on every pool thread. Each slice is scanned with
+ * SIMD compares and only the rare unequal elements take the scalar ULP
+ * path, so a correct result costs about one pass over the three vectors
+ * at memory bandwidth.
+ */
+inline Report verify_add(hostpool::ThreadPool &pool, const float *a, const float *b, const float *c, size_t n,
+                         uint32_t max_ulps, size_t report_limit = 10) {
+   auto begin_time = std::chrono::steady_clock::now();
+   std::vector<Report> partial(pool.size());
+   pool.parallel_for(n, [&](size_t begin, size_t end, unsigned worker) {
+      Report &report = partial[worker];
+      for (size_t i = hostsimd::first_difference(a, b, c, begin, end); i < end;
+           i = hostsimd::first_difference(a, b, c, i + 1, end)) {
+         const float expected = a[i] + b[i];
+         const uint32_t ulps = ulp_distance(expected, c[i]);
+         report.max_ulps = std::max(report.max_ulps, ulps);
+         if (ulps <= max_ulps)
+            continue;
+         if (report.first.size() < report_limit)
+            report.first.push_back({i, expected, c[i], ulps});
+         ++report.mismatches;
+      }
+   });
+
+   // slices are in index order, so the first report_limit entries across them are the lowest indices
+   Report report;
+   report.checked = n;
+   for (auto &slice : partial) {
+      report.mismatches += slice.mismatches;
+      report.max_ulps = std::max(report.max_ulps, slice.max_ulps);
+      for (auto &mismatch : slice.first)
+         if (report.first.size() < report_limit)
+            report.first.push_back(mismatch);
+   }
+   report.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin_time).count();
+   return report;
+}
+
+inline void print_report(const Report &report, uint32_t max_ulps) {
+   std::cout << "Verified " << report.checked << " elements in " << report.ms << " ms (" << hostsimd::isa() << "): ";
+   if (report.mismatches == 0) {
+      std::cout << "all within " << max_ulps << " ulp, max " << report.max_ulps << std::endl;
+      return;
+   }
+   std::cout << report.mismatches << " mismatches beyond " << max_ulps << " ulp" << std::endl;
+   // enough digits to tell neighbouring floats apart
+   std::streamsize precision = std::cout.precision(9);
+   for (auto &mismatch : report.first)
+      std::cout << "  c[" << mismatch.index << "] = " << mismatch.actual << ", expected " << mismatch.expected
+                << " (" << mismatch.ulps << " ulp)" << std::endl;
+   std::cout.precision(precision);
+}
+
+}
+
+#endif
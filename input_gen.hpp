@@ -0,0 +1,185 @@
+//
+// Input generation on the device, and the same generators on host threads.
+//
+
+#ifndef INPUT_GEN_HPP
+#define INPUT_GEN_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <CL/opencl.h>
+#include "program_cache.hpp"
+#include "thread_pool.hpp"
+
+namespace clinit {
+
+enum class Pattern {
+   ramp,      // x[i] = fma(i, step, start)
+   constant,  // x[i] = start
+   philox     // uniform in [start, start + step) from Philox4x32-10, keyed by (seed, stream)
+};
+
+inline Pattern parse_pattern(const std::string &name) {
+   if (name == "constant") return Pattern::constant;
+   if (name == "philox") return Pattern::philox;
+   return Pattern::ramp;
+}
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"), four outputs per counter
+inline void philox4x32(uint32_t counter[4], uint32_t key0, uint32_t key1) {
+   for (int round = 0; round < 10; ++round) {
+      if (round > 0) {
+         key0 += 0x9E3779B9u;
+         key1 += 0xBB67AE85u;
+      }
+      const uint64_t product0 = static_cast<uint64_t>(0xD2511F53u) * counter[0];
+      const uint64_t product1 = static_cast<uint64_t>(0xCD9E8D57u) * counter[2];
+      const uint32_t next[4] = {static_cast<uint32_t>(product1 >> 32) ^ counter[1] ^ key0,
+                                static_cast<uint32_t>(product1),
+                                static_cast<uint32_t>(product0 >> 32) ^ counter[3] ^ key1,
+                                static_cast<uint32_t>(product0)};
+      for (int word = 0; word < 4; ++word)
+         counter[word] = next[word];
+   }
+}
+
+// Top 24 bits as a float in [0, 1)
+inline float unit_float(uint32_t bits) {
+   return static_cast<float>(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+/**
+ * OpenCL C versions of the generators above. Every value goes through an
+ * explicit fma() on both sides, so device and host inputs agree bit for
+ * bit and can be checked against each other.
+ */
+inline std::string source() {
+   return "__kernel void fill_ramp(__global float *x, const unsigned int n, const float start, const float step)\n"
+          "{\n"
+          "    size_t i = get_global_id(0);\n"
+          "    if (i < n)\n"
+          "        x[i] = fma((float) i, step, start);\n"
+          "}\n"
+          "\n"
+          "__kernel void fill_constant(__global float *x, const unsigned int n, const float value)\n"
+          "{\n"
+          "    size_t i = get_global_id(0);\n"
+          "    if (i < n)\n"
+          "        x[i] = value;\n"
+          "}\n"
+          "\n"
+          "// one Philox4x32-10 block of four values per work item\n"
+          "__kernel void fill_philox(__global float *x, const unsigned int n, const float start, const float step,\n"
+          "                          const uint seed, const uint stream)\n"
+          "{\n"
+          "    size_t block = get_global_id(0);\n"
+          "    uint c[4] = {(uint) block, 0, 0, 0};\n"
+          "    uint k0 = seed, k1 = stream;\n"
+          "    for (int round = 0; round < 10; ++round) {\n"
+          "        if (round > 0) {\n"
+          "            k0 += 0x9E3779B9u;\n"
+          "            k1 += 0xBB67AE85u;\n"
+          "        }\n"
+          "        uint hi0 = mul_hi(0xD2511F53u, c[0]), lo0 = 0xD2511F53u * c[0];\n"
+          "        uint hi1 = mul_hi(0xCD9E8D57u, c[2]), lo1 = 0xCD9E8D57u * c[2];\n"
+          "        c[0] = hi1 ^ c[1] ^ k0;\n"
+          "        c[1] = lo1;\n"
+          "        c[2] = hi0 ^ c[3] ^ k1;\n"
+          "        c[3] = lo0;\n"
+          "    }\n"
+          "    for (int word = 0; word < 4; ++word) {\n"
+          "        size_t i = block * 4 + word;\n"
+          "        if (i < n)\n"
+          "            x[i] = fma((float) (c[word] >> 8) * (1.0f / 16777216.0f), step, start);\n"
+          "    }\n"
+          "}\n";
+}
+
+/**
+ * Fills device buffers with generated inputs, so synthetic runs skip the
+ * host loop and the upload.
+ */
+class Generator {
+public:
+   Generator(cl_context context, cl_device_id device, clcache::ProgramCache &program_cache, cl_int *err) {
+      const std::string text = source();
+      program_ = program_cache.build(context, device, text.c_str(), "", err);
+      if (program_ == nullptr)
+         return;
+      const char *names[] = {"fill_ramp", "fill_constant", "fill_philox"};
+      for (int k = 0; k < 3; ++k) {
+         kernels_[k] = clCreateKernel(program_, names[k], err);
+         if (*err != CL_SUCCESS)
+            return;
+      }
+   }
+
+   Generator(const Generator &) = delete;
+   Generator &operator=(const Generator &) = delete;
+
+   ~Generator() {
+      for (cl_kernel kernel : kernels_)
+         if (kernel != nullptr) clReleaseKernel(kernel);
+      if (program_ != nullptr) clReleaseProgram(program_);
+   }
+
+   // Enqueue the generation of x[0, n); stream separates the Philox sequences of different vectors
+   cl_int fill(cl_command_queue queue, cl_mem x, unsigned int n, Pattern pattern, float start, float step,
+               uint32_t seed, uint32_t stream, cl_event *event = nullptr) {
+      cl_kernel kernel = kernels_[static_cast<int>(pattern)];
+      cl_int err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &x);
+      err |= clSetKernelArg(kernel, 1, sizeof(unsigned int), &n);
+      err |= clSetKernelArg(kernel, 2, sizeof(float), &start);
+      if (pattern != Pattern::constant)
+         err |= clSetKernelArg(kernel, 3, sizeof(float), &step);
+      if (pattern == Pattern::philox) {
+         err |= clSetKernelArg(kernel, 4, sizeof(uint32_t), &seed);
+         err |= clSetKernelArg(kernel, 5, sizeof(uint32_t), &stream);
+      }
+      if (err != CL_SUCCESS)
+         return err;
+      size_t global_size = pattern == Pattern::philox ? (n + 3) / 4 : n;
+      global_size = std::max<size_t>(global_size, 1);
+      return clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &global_size, nullptr, 0, nullptr, event);
+   }
+
+private:
+   cl_program program_ = nullptr;
+   cl_kernel kernels_[3] = {nullptr, nullptr, nullptr};
+};
+
+/**
+ * Host copy of the same inputs, written by the pool threads that own each
+ * slice. On freshly allocated memory this is the first touch, so pages end
+ * up on the NUMA node of the thread that later reads them.
+ */
+inline void fill_host(hostpool::ThreadPool &pool, float *x, size_t n, Pattern pattern, float start, float step,
+                      uint32_t seed, uint32_t stream) {
+   pool.parallel_for(n, [&](size_t begin, size_t end, unsigned) {
+      switch (pattern) {
+         case Pattern::ramp:
+            for (size_t i = begin; i < end; ++i)
+               x[i] = std::fma(static_cast<float>(i), step, start);
+            break;
+         case Pattern::constant:
+            for (size_t i = begin; i < end; ++i)
+               x[i] = start;
+            break;
+         case Pattern::philox:
+            // slices start at multiples of 16, so every Philox block lies in one slice
+            for (size_t block = begin / 4; block * 4 < end; ++block) {
+               uint32_t counter[4] = {static_cast<uint32_t>(block), 0, 0, 0};
+               philox4x32(counter, seed, stream);
+               for (size_t word = 0; word < 4 && block * 4 + word < end; ++word)
+                  x[block * 4 + word] = std::fma(unit_float(counter[word]), step, start);
+            }
+            break;
+      }
+   });
+}
+
+}
+
+#endif
@@ -0,0 +1,156 @@
+//
+// Generated OpenCL source for the vector addition kernel variants.
+//
+
+#ifndef KERNEL_GEN_HPP
+#define KERNEL_GEN_HPP
+
+#include <algorithm>
+#include <string>
+#include <CL/opencl.h>
+
+namespace clkernels {
+
+// How work items map onto the vectors of the problem
+enum class Layout {
+   one_per_item,  // one vector per work item, global size follows n
+   strided,       // grid-stride loop, neighbouring items touch neighbouring vectors (coalesced)
+   contiguous     // every item walks its own contiguous block of vectors (cache friendly on CPUs)
+};
+
+inline const char *layout_name(Layout layout) {
+   switch (layout) {
+      case Layout::strided: return "strided";
+      case Layout::contiguous: return "contiguous";
+      default: return "one_per_item";
+   }
+}
+
+/**
+ * One generated vecAdd kernel. Every variant keeps the
+ * (__global a, __global b, __global c, const unsigned int n) signature, so
+ * the host only needs global_size() to launch any of them.
+ */
+struct Variant {
+   std::string name = "vecAdd";
+   std::string source;
+   unsigned width = 1;                   // elements loaded and stored per vector operation
+   Layout layout = Layout::one_per_item;
+   size_t coarsening = 1;                // vectors per work item for the grid-stride layouts
+
+   // Identifies the variant in tuning files and reports
+   std::string key() const {
+      std::string key = name + ".w" + std::to_string(width);
+      if (layout != Layout::one_per_item)
+         key += std::string(".") + layout_name(layout) + ".k" + std::to_string(coarsening);
+      return key;
+   }
+
+   // Work items to enqueue for n elements, rounded up to local_size (0 = NULL local size)
+   size_t global_size(size_t n, size_t local_size) const {
+      size_t items = (n + width - 1) / width;
+      if (layout != Layout::one_per_item)
+         items = std::max<size_t>(1, (items + coarsening - 1) / coarsening);
+      return local_size ? (items + local_size - 1) / local_size * local_size : items;
+   }
+};
+
+inline bool valid_width(unsigned width) {
+   return width == 1 || width == 2 || width == 4 || width == 8 || width == 16;
+}
+
+// Statement adding the vector of `width` elements starting at element `base`, with a scalar tail
+inline std::string add_vector(unsigned width, const std::string &indent) {
+   if (width == 1)
+      return indent + "c[base] = a[base] + b[base];\n";
+   const std::string w = std::to_string(width);
+   return indent + "if (base + " + w + " <= n) {\n" +
+          indent + "    vstore" + w + "(vload" + w + "(0, a + base) + vload" + w + "(0, b + base), 0, c + base);\n" +
+          indent + "} else {\n" +
+          indent + "    for (size_t i = base; i < n; ++i)\n" +
+          indent + "        c[i] = a[i] + b[i];\n" +
+          indent + "}\n";
+}
+
+// c = a + b with floatN loads and stores; items past the last whole vector take a scalar tail.
+// The grid-stride layouts loop so that one launch of any global size covers all n elements.
+inline Variant vector_add(unsigned width, Layout layout = Layout::one_per_item, size_t coarsening = 1) {
+   Variant variant;
+   variant.width = valid_width(width) ? width : 1;
+   variant.layout = layout;
+   variant.coarsening = std::max<size_t>(coarsening, 1);
+   if (variant.width == 1 && layout == Layout::one_per_item) {
+      variant.source =
+              "__kernel void vecAdd(  __global float *a,                       \n"
+              "                       __global float *b,                       \n"
+              "                       __global float *c,                       \n"
+              "                       const unsigned int n)                    \n"
+              "{                                                               \n"
+              "    //Get our global thread ID                                  \n"
+              "    int id = get_global_id(0);                                  \n"
+              "                                                                \n"
+              "    //Make sure we do not go out of bounds                      \n"
+              "    if (id < n){                                                \n"
+              "        c[id] = a[id] + b[id];                                  \n"
+              "    }                                                           \n"
+              "}                                                               \n";
+      return variant;
+   }
+   const std::string w = std::to_string(variant.width);
+   std::string source =
+           "__kernel void vecAdd(  __global const float *a,                 \n"
+           "                       __global const float *b,                 \n"
+           "                       __global float *c,                       \n"
+           "                       const unsigned int n)                    \n"
+           "{                                                               \n";
+   switch (layout) {
+      case Layout::one_per_item:
+         source += "    size_t base = get_global_id(0) * " + w + ";\n" +
+                   add_vector(variant.width, "    ");
+         break;
+      case Layout::strided:
+         source += "    size_t vectors = (n + " + w + " - 1) / " + w + ";\n"
+                   "    for (size_t v = get_global_id(0); v < vectors; v += get_global_size(0)) {\n"
+                   "        size_t base = v * " + w + ";\n" +
+                   add_vector(variant.width, "        ") +
+                   "    }\n";
+         break;
+      case Layout::contiguous:
+         source += "    size_t vectors = (n + " + w + " - 1) / " + w + ";\n"
+                   "    size_t per_item = (vectors + get_global_size(0) - 1) / get_global_size(0);\n"
+                   "    size_t first = get_global_id(0) * per_item;\n"
+                   "    size_t last = min(first + per_item, vectors);\n"
+                   "    for (size_t v = first; v < last; ++v) {\n"
+                   "        size_t base = v * " + w + ";\n" +
+                   add_vector(variant.width, "        ") +
+                   "    }\n";
+         break;
+   }
+   variant.source = source + "}\n";
+   return variant;
+}
+
+// Vectors per work item that leave CL_DEVICE_MAX_COMPUTE_UNITS x 8 groups x 64 items in flight
+inline size_t occupancy_coarsening(cl_device_id device, size_t n, unsigned width) {
+   cl_uint compute_units = 1;
+   clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, nullptr);
+   const size_t items = static_cast<size_t>(std::max<cl_uint>(compute_units, 1)) * 8 * 64;
+   const size_t vectors = (n + width - 1) / width;
+   return std::max<size_t>(1, (vectors + items - 1) / items);
+}
+
+// Widest of CL_DEVICE_PREFERRED/NATIVE_VECTOR_WIDTH_FLOAT, rounded down to a supported width
+inline unsigned device_width(cl_device_id device) {
+   cl_uint preferred = 1, native = 1;
+   clGetDeviceInfo(device, CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT, sizeof(preferred), &preferred, nullptr);
+   clGetDeviceInfo(device, CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT, sizeof(native), &native, nullptr);
+   unsigned width = std::max<cl_uint>(std::max<cl_uint>(preferred, native), 1);
+   unsigned supported = 1;
+   while (supported * 2 <= std::min(width, 16u))
+      supported *= 2;
+   return supported;
+}
+
+}
+
+#endif
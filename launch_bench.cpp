@@ -0,0 +1,246 @@
+//
+// Kernel launch latency, launch throughput and the vector length where each device beats the host.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+#include "bench_stats.hpp"
+#include "cl_raii.hpp"
+#include "device_registry.hpp"
+#include "host_simd.hpp"
+#include "kernel_gen.hpp"
+#include "native_backend.hpp"
+#include "program_cache.hpp"
+
+const char *emptySource =
+        "__kernel void empty()\n"
+        "{\n"
+        "}\n";
+
+// Wall time of fn() in microseconds
+template <typename Function>
+double wall_us(Function fn) {
+   auto begin = std::chrono::steady_clock::now();
+   fn();
+   return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// Median over repeats of fn(), after one untimed call
+template <typename Function>
+double median_us(int repeats, Function fn) {
+   std::vector<double> samples;
+   fn();
+   for (int repeat = 0; repeat < repeats; ++repeat)
+      samples.push_back(wall_us(fn));
+   return benchstats::summarize(samples).median;
+}
+
+// Round trip and throughput of an empty kernel on one work item
+cl_int measure_launches(cl_command_queue queue, cl_kernel empty, int repeats, int burst) {
+   const size_t one = 1;
+   std::vector<double> round_trip, dispatch, execution;
+   cl_int err = CL_SUCCESS;
+   for (int repeat = 0; repeat <= repeats && err == CL_SUCCESS; ++repeat) {
+      cl_event event = nullptr;
+      double us = wall_us([&]() {
+         err = clEnqueueNDRangeKernel(queue, empty, 1, nullptr, &one, &one, 0, nullptr, &event);
+         if (err == CL_SUCCESS)
+            err = clFinish(queue);
+      });
+      if (err == CL_SUCCESS && repeat > 0) {
+         cl_ulong queued = 0, start = 0, end = 0;
+         clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(queued), &queued, nullptr);
+         clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+         clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+         round_trip.push_back(us);
+         dispatch.push_back((start - queued) / 1e3);
+         execution.push_back((end - start) / 1e3);
+      }
+      if (event != nullptr) clReleaseEvent(event);
+   }
+   if (err != CL_SUCCESS)
+      return err;
+   benchstats::Summary trip = benchstats::summarize(round_trip);
+   std::cout << "  empty kernel enqueue + clFinish: median " << trip.median << " us, p95 " << trip.p95
+             << " us (queued to start " << benchstats::summarize(dispatch).median << " us, start to end "
+             << benchstats::summarize(execution).median << " us)" << std::endl;
+
+   // many launches, one synchronization: what the queue sustains when nobody waits
+   std::vector<double> bursts;
+   for (int repeat = 0; repeat <= repeats / 10 + 1 && err == CL_SUCCESS; ++repeat) {
+      double us = wall_us([&]() {
+         for (int launch = 0; launch < burst && err == CL_SUCCESS; ++launch)
+            err = clEnqueueNDRangeKernel(queue, empty, 1, nullptr, &one, &one, 0, nullptr, nullptr);
+         if (err == CL_SUCCESS)
+            err = clFinish(queue);
+      });
+      if (repeat > 0)
+         bursts.push_back(us);
+   }
+   if (err != CL_SUCCESS)
+      return err;
+   const double burst_us = benchstats::summarize(bursts).median;
+   std::cout << "  " << burst << " launches without syncs: " << burst_us / 1e3 << " ms, "
+             << burst / burst_us * 1e6 << " launches/s (" << burst_us / burst << " us each)" << std::endl;
+   return CL_SUCCESS;
+}
+
+/**
+ * c = a + b for growing n on the device, once with the data already
+ * resident (launch + finish) and once with the upload and download, against
+ * the faster of one host thread and the native thread pool. Prints the
+ * smallest n from which the device wins at that and every larger size in
+ * each case, so one noisy sample cannot set the break-even point.
+ */
+cl_int measure_break_even(cl_context context, cl_device_id device, cl_command_queue queue,
+                          clcache::ProgramCache &program_cache, hostnative::Backend &backend,
+                          size_t max_elements, int repeats) {
+   cl_int err;
+   // three buffers of max_elements floats have to fit the device, as in transfer_bench
+   cl_ulong max_alloc = 0, global_mem = 0;
+   clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, nullptr);
+   clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, nullptr);
+   max_elements = std::min<size_t>(max_elements, std::min<cl_ulong>(max_alloc, global_mem / 4) / sizeof(float));
+   const clkernels::Variant variant = clkernels::vector_add(1);
+   clwrap::Program program(program_cache.build(context, device, variant.source.c_str(), "", &err));
+   clwrap::Kernel kernel;
+   if (program)
+      kernel = clwrap::create_kernel(program.get(), variant.name.c_str(), &err);
+   const size_t max_bytes = max_elements * sizeof(float);
+   clwrap::Buffer d_a, d_b, d_c;
+   if (err == CL_SUCCESS)
+      d_a = clwrap::create_buffer(context, CL_MEM_READ_ONLY, max_bytes, nullptr, &err);
+   if (err == CL_SUCCESS)
+      d_b = clwrap::create_buffer(context, CL_MEM_READ_ONLY, max_bytes, nullptr, &err);
+   if (err == CL_SUCCESS)
+      d_c = clwrap::create_buffer(context, CL_MEM_WRITE_ONLY, max_bytes, nullptr, &err);
+   if (err != CL_SUCCESS)
+      return err;
+   std::vector<float> h_a(max_elements, 1.0f), h_b(max_elements, 2.0f), h_c(max_elements);
+   cl_mem buffers[] = {d_a.get(), d_b.get(), d_c.get()};
+   for (cl_uint arg = 0; arg < 3; ++arg)
+      err |= clSetKernelArg(kernel.get(), arg, sizeof(cl_mem), &buffers[arg]);
+   if (err != CL_SUCCESS)
+      return err;
+
+   std::streamsize precision = std::cout.precision();
+   std::cout << "  " << std::setw(10) << "elements" << std::setw(12) << "host us" << std::setw(12) << "device us"
+             << std::setw(22) << "device+transfer us" << std::endl;
+   size_t resident_wins = 0, transfer_wins = 0;
+   for (size_t n = 64; n <= max_elements; n *= 4) {
+      const unsigned int elements = static_cast<unsigned int>(n);
+      const size_t bytes = n * sizeof(float);
+      size_t global = variant.global_size(n, 0);
+      err = clSetKernelArg(kernel.get(), 3, sizeof(unsigned int), &elements);
+      auto launch = [&]() {
+         err = clEnqueueNDRangeKernel(queue, kernel.get(), 1, nullptr, &global, nullptr, 0, nullptr, nullptr);
+         if (err == CL_SUCCESS)
+            err = clFinish(queue);
+      };
+      const double device_us = median_us(repeats, launch);
+      const double transfer_us = median_us(repeats, [&]() {
+         err = clEnqueueWriteBuffer(queue, d_a.get(), CL_FALSE, 0, bytes, h_a.data(), 0, nullptr, nullptr);
+         err |= clEnqueueWriteBuffer(queue, d_b.get(), CL_FALSE, 0, bytes, h_b.data(), 0, nullptr, nullptr);
+         err |= clEnqueueNDRangeKernel(queue, kernel.get(), 1, nullptr, &global, nullptr, 0, nullptr, nullptr);
+         err |= clEnqueueReadBuffer(queue, d_c.get(), CL_TRUE, 0, bytes, h_c.data(), 0, nullptr, nullptr);
+      });
+      if (err != CL_SUCCESS)
+         break;
+      const double host_us = std::min(
+              median_us(repeats, [&]() { hostsimd::add(h_a.data(), h_b.data(), h_c.data(), 0, n); }),
+              median_us(repeats, [&]() { backend.add(h_a.data(), h_b.data(), h_c.data(), n); }));
+      // a loss at a larger size moves the break-even point past it
+      resident_wins = device_us < host_us ? (resident_wins ? resident_wins : n) : 0;
+      transfer_wins = transfer_us < host_us ? (transfer_wins ? transfer_wins : n) : 0;
+      std::cout << "  " << std::setw(10) << n << std::fixed << std::setprecision(1) << std::setw(12) << host_us
+                << std::setw(12) << device_us << std::setw(22) << transfer_us << std::endl;
+      std::cout.unsetf(std::ios::fixed);
+      std::cout.precision(precision);
+   }
+   auto describe = [](size_t n) { return n ? "from " + std::to_string(n) + " elements" : std::string("never"); };
+   std::cout << "  device beats the host " << describe(resident_wins) << " with resident data, "
+             << describe(transfer_wins) << " with transfers" << std::endl;
+   return err;
+}
+
+int main(int argc, char *argv[]) {
+   // --repeats R: timed samples per measurement; --burst K: launches per throughput sample
+   // --max-elements N: largest break-even vector; --host-threads T: native pool size, 0 = all
+   // --devices LIST: as in vec_add; --cache-dir DIR / --no-cache: program binaries
+   int repeats = 100, burst = 1000;
+   size_t max_elements = 1 << 24;
+   unsigned int host_threads = 0;
+   std::string device_pattern = "all";
+   std::string cache_dir = ".clcache";
+   for (int arg = 1; arg < argc; ++arg) {
+      std::string option(argv[arg]);
+      if (option == "--repeats" && arg + 1 < argc) {
+         repeats = std::max(1, atoi(argv[++arg]));
+      } else if (option == "--burst" && arg + 1 < argc) {
+         burst = std::max(1, atoi(argv[++arg]));
+      } else if (option == "--max-elements" && arg + 1 < argc) {
+         max_elements = std::max<size_t>(64, strtoull(argv[++arg], nullptr, 10));
+      } else if (option == "--host-threads" && arg + 1 < argc) {
+         host_threads = strtoul(argv[++arg], nullptr, 10);
+      } else if (option == "--devices" && arg + 1 < argc) {
+         device_pattern = argv[++arg];
+      } else if (option == "--cache-dir" && arg + 1 < argc) {
+         cache_dir = argv[++arg];
+      } else if (option == "--no-cache") {
+         cache_dir.clear();
+      } else {
+         std::cout << "Unknown option " << option << std::endl;
+         std::cout << "Usage: " << argv[0] << " [--repeats R] [--burst K] [--max-elements N] [--host-threads T]"
+                   << " [--devices LIST] [--cache-dir DIR | --no-cache]" << std::endl;
+         return -1;
+      }
+   }
+   clcache::ProgramCache program_cache(cache_dir);
+   hostnative::Backend backend(host_threads);
+
+   cldevices::Registry registry;
+   if (registry.list().empty()) {
+      std::cout << "Cannot get platform" << std::endl;
+      return -1;
+   }
+   std::vector<cldevices::Entry> selected = registry.select(device_pattern);
+   if (selected.empty()) {
+      std::cout << "No device matches --devices " << device_pattern << "; available devices:" << std::endl;
+      registry.print();
+      return -1;
+   }
+
+   std::cout << "Host reference: one thread with " << hostsimd::isa() << ", or " << backend.name() << std::endl;
+   int status = 0;
+   for (const cldevices::Entry &entry : selected) {
+      std::cout << "Device " << entry.label() << std::endl;
+      cl_int err;
+      clwrap::Context context = clwrap::create_context(entry.device, &err);
+      clwrap::Queue queue;
+      clwrap::Program program;
+      clwrap::Kernel empty;
+      if (err == CL_SUCCESS)
+         queue = clwrap::create_queue(context.get(), entry.device, CL_QUEUE_PROFILING_ENABLE, &err);
+      if (err == CL_SUCCESS)
+         program = clwrap::Program(program_cache.build(context.get(), entry.device, emptySource, "", &err));
+      if (program)
+         empty = clwrap::create_kernel(program.get(), "empty", &err);
+      if (err == CL_SUCCESS)
+         err = measure_launches(queue.get(), empty.get(), repeats, burst);
+      if (err == CL_SUCCESS)
+         err = measure_break_even(context.get(), entry.device, queue.get(), program_cache, backend,
+                                  std::min<size_t>(max_elements, 0xffffffffu), std::max(1, repeats / 10));
+      if (err != CL_SUCCESS) {
+         std::cout << "  failed with error " << err << std::endl;
+         status = -1;
+      }
+   }
+   program_cache.print_stats();
+   return status;
+}
@@ -0,0 +1,61 @@
+//
+// Native host implementation of the vector kernels, run like one more device.
+//
+
+#ifndef NATIVE_BACKEND_HPP
+#define NATIVE_BACKEND_HPP
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "host_simd.hpp"
+#include "thread_pool.hpp"
+
+namespace hostnative {
+
+/**
+ * The vecAdd engine without OpenCL: a pinned thread pool with SIMD inner
+ * loops. Every call splits the range the same way, so data first touched
+ * through pool() (see clinit::fill_host) is processed by the thread on the
+ * NUMA node that owns it. Gives a baseline for the CPU OpenCL runtimes and
+ * a fallback on hosts without any OpenCL platform.
+ */
+class Backend {
+public:
+   explicit Backend(unsigned threads = 0) : pool_(threads, true) {}
+
+   std::string name() const {
+      return "Native host (" + std::to_string(pool_.size()) + " threads, " + hostsimd::isa() + ")";
+   }
+
+   hostpool::ThreadPool &pool() { return pool_; }
+
+   // c = a + b
+   void add(const float *a, const float *b, float *c, size_t n) {
+      pool_.parallel_for(n, [=](size_t begin, size_t end, unsigned) {
+         hostsimd::add(a, b, c, begin, end);
+      });
+   }
+
+   // Sum of x in double per slice, like the device reduction's second stage
+   double sum(const float *x, size_t n) {
+      std::vector<double> partial(pool_.size(), 0.0);
+      pool_.parallel_for(n, [&](size_t begin, size_t end, unsigned worker) {
+         double total = 0;
+         for (size_t i = begin; i < end; ++i)
+            total += x[i];
+         partial[worker] = total;
+      });
+      double total = 0;
+      for (double value : partial)
+         total += value;
+      return total;
+   }
+
+private:
+   hostpool::ThreadPool pool_;
+};
+
+}
+
+#endif
@@ -0,0 +1,232 @@
+//
+// Persistent cache of compiled OpenCL program binaries.
+//
+
+#ifndef PROGRAM_CACHE_HPP
+#define PROGRAM_CACHE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <CL/opencl.h>
+
+namespace clcache {
+
+// 64 bit FNV-1a, used both for cache keys and for binary checksums
+inline uint64_t fnv1a(const void *data, size_t length, uint64_t hash = 14695981039346656037ULL) {
+   const unsigned char *bytes = static_cast<const unsigned char *>(data);
+   for (size_t i = 0; i < length; ++i) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+   }
+   return hash;
+}
+
+inline uint64_t fnv1a(const std::string &text, uint64_t hash = 14695981039346656037ULL) {
+   // Hash the terminating zero as well so that ("ab", "c") and ("a", "bc") differ
+   return fnv1a(text.c_str(), text.size() + 1, hash);
+}
+
+inline std::string device_string(cl_device_id device, cl_device_info name) {
+   size_t length = 0;
+   if (clGetDeviceInfo(device, name, 0, nullptr, &length) != CL_SUCCESS || length == 0)
+      return "";
+   std::vector<char> value(length);
+   clGetDeviceInfo(device, name, length, value.data(), nullptr);
+   return std::string(value.data());
+}
+
+inline std::string platform_string(cl_platform_id platform, cl_platform_info name) {
+   size_t length = 0;
+   if (clGetPlatformInfo(platform, name, 0, nullptr, &length) != CL_SUCCESS || length == 0)
+      return "";
+   std::vector<char> value(length);
+   clGetPlatformInfo(platform, name, length, value.data(), nullptr);
+   return std::string(value.data());
+}
+
+/**
+ * Builds programs from source once per (source, options, device, driver,
+ * platform) and keeps the resulting CL_PROGRAM_BINARIES on disk. Later
+ * builds load the binary with clCreateProgramWithBinary and fall back to
+ * the source whenever the cached file is missing, corrupt or rejected.
+ */
+class ProgramCache {
+public:
+   // An empty directory disables the cache and always builds from source
+   explicit ProgramCache(const std::string &directory) : directory_(directory) {
+      if (!directory_.empty())
+         mkdir(directory_.c_str(), 0755);
+   }
+
+   unsigned hits() const { return hits_; }
+   unsigned misses() const { return misses_; }
+
+   // Create and build a program for a single device. Returns nullptr and sets err on failure.
+   cl_program build(cl_context context, cl_device_id device, const char *source,
+                    const std::string &options, cl_int *err) {
+      const uint64_t key = make_key(device, source, options);
+      const std::string path = directory_ + "/" + to_hex(key) + ".bin";
+
+      if (!directory_.empty()) {
+         auto begin = std::chrono::steady_clock::now();
+         uint64_t build_micros = 0;
+         cl_program program = load(context, device, path, key, options, &build_micros);
+         if (program != nullptr) {
+            auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - begin).count();
+            ++hits_;
+            if (build_micros > static_cast<uint64_t>(micros))
+               saved_micros_ += build_micros - micros;
+            *err = CL_SUCCESS;
+            return program;
+         }
+      }
+
+      ++misses_;
+      auto begin = std::chrono::steady_clock::now();
+      cl_program program = clCreateProgramWithSource(context, 1, &source, nullptr, err);
+      if (program == nullptr)
+         return nullptr;
+      *err = clBuildProgram(program, 1, &device, options.c_str(), nullptr, nullptr);
+      if (*err != CL_SUCCESS) {
+         print_build_log(program, device);
+         clReleaseProgram(program);
+         return nullptr;
+      }
+      uint64_t build_micros = std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - begin).count();
+      if (!directory_.empty())
+         store(program, path, key, build_micros);
+      return program;
+   }
+
+   void print_stats() const {
+      if (directory_.empty())
+         return;
+      std::cout << "Program cache " << directory_ << ": " << hits_ << " hits, " << misses_
+                << " misses, saved " << saved_micros_ / 1000 << " milliseconds of compilation" << std::endl;
+   }
+
+   static void print_build_log(cl_program program, cl_device_id device) {
+      size_t length = 0;
+      clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, nullptr, &length);
+      if (length <= 1)
+         return;
+      std::vector<char> log(length);
+      clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, length, log.data(), nullptr);
+      std::cout << log.data() << std::endl;
+   }
+
+private:
+   // On-disk layout: magic, key, build time, binary size, binary checksum, binary
+   struct Header {
+      char magic[8];
+      uint64_t key;
+      uint64_t build_micros;
+      uint64_t size;
+      uint64_t checksum;
+   };
+
+   static uint64_t make_key(cl_device_id device, const char *source, const std::string &options) {
+      cl_platform_id platform = nullptr;
+      clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr);
+      uint64_t key = fnv1a(std::string(source));
+      key = fnv1a(options, key);
+      key = fnv1a(device_string(device, CL_DEVICE_NAME), key);
+      key = fnv1a(device_string(device, CL_DRIVER_VERSION), key);
+      key = fnv1a(platform_string(platform, CL_PLATFORM_NAME), key);
+      key = fnv1a(platform_string(platform, CL_PLATFORM_VERSION), key);
+      return key;
+   }
+
+   static std::string to_hex(uint64_t value) {
+      std::ostringstream out;
+      out << std::hex;
+      out.width(16);
+      out.fill('0');
+      out << value;
+      return out.str();
+   }
+
+   static cl_program load(cl_context context, cl_device_id device, const std::string &path,
+                          uint64_t key, const std::string &options, uint64_t *build_micros) {
+      std::ifstream in(path, std::ios::binary);
+      if (!in)
+         return nullptr;
+      Header header;
+      if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+          std::string(header.magic, sizeof(header.magic)) != std::string(magic(), sizeof(header.magic)) ||
+          header.key != key || header.size == 0 || header.size > (1ULL << 31))
+         return nullptr;
+      std::vector<unsigned char> binary(header.size);
+      if (!in.read(reinterpret_cast<char *>(binary.data()), binary.size()) ||
+          fnv1a(binary.data(), binary.size()) != header.checksum) {
+         std::cout << "Ignoring corrupt program cache entry " << path << std::endl;
+         return nullptr;
+      }
+
+      size_t size = binary.size();
+      const unsigned char *data = binary.data();
+      cl_int status = CL_SUCCESS, err;
+      cl_program program = clCreateProgramWithBinary(context, 1, &device, &size, &data, &status, &err);
+      if (program == nullptr || err != CL_SUCCESS || status != CL_SUCCESS) {
+         if (program != nullptr)
+            clReleaseProgram(program);
+         return nullptr;
+      }
+      if (clBuildProgram(program, 1, &device, options.c_str(), nullptr, nullptr) != CL_SUCCESS) {
+         clReleaseProgram(program);
+         return nullptr;
+      }
+      *build_micros = header.build_micros;
+      return program;
+   }
+
+   static void store(cl_program program, const std::string &path, uint64_t key, uint64_t build_micros) {
+      size_t size = 0;
+      if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, nullptr) != CL_SUCCESS ||
+          size == 0)
+         return;
+      std::vector<unsigned char> binary(size);
+      unsigned char *data = binary.data();
+      if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, nullptr) != CL_SUCCESS)
+         return;
+
+      Header header;
+      std::copy(magic(), magic() + sizeof(header.magic), header.magic);
+      header.key = key;
+      header.build_micros = build_micros;
+      header.size = size;
+      header.checksum = fnv1a(binary.data(), binary.size());
+
+      // Write to a temporary file first so concurrent runs never see a partial entry
+      const std::string temporary = path + ".tmp";
+      {
+         std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+         out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+         out.write(reinterpret_cast<const char *>(binary.data()), binary.size());
+         if (!out)
+            return;
+      }
+      std::rename(temporary.c_str(), path.c_str());
+   }
+
+   static const char *magic() { return "CLPCACH1"; }
+
+   std::string directory_;
+   unsigned hits_ = 0;
+   unsigned misses_ = 0;
+   uint64_t saved_micros_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,191 @@
+//
+// Work-group tree reduction (compensated sum, min and max) of device vectors.
+//
+
+#ifndef REDUCTION_HPP
+#define REDUCTION_HPP
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+#include "program_cache.hpp"
+
+namespace clreduce {
+
+struct Result {
+   double sum = 0;
+   float min = std::numeric_limits<float>::infinity();
+   float max = -std::numeric_limits<float>::infinity();
+};
+
+// Body shared by both kernels; LOAD(i) yields element i of the reduced vector
+inline std::string reduce_body() {
+   return "{\n"
+          "    // compensated per item: sum + err is the exact running total up to float rounding of err\n"
+          "    float sum = 0.0f, err = 0.0f, lo = INFINITY, hi = -INFINITY;\n"
+          "    for (size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+          "        float value = LOAD(i);\n"
+          "        float s, e;\n"
+          "        two_sum(sum, value, &s, &e);\n"
+          "        sum = s;\n"
+          "        err += e;\n"
+          "        lo = fmin(lo, value);\n"
+          "        hi = fmax(hi, value);\n"
+          "    }\n"
+          "    size_t lid = get_local_id(0);\n"
+          "    l_sum[lid] = sum;\n"
+          "    l_err[lid] = err;\n"
+          "    l_min[lid] = lo;\n"
+          "    l_max[lid] = hi;\n"
+          "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+          "    // pairwise tree over the work-group, local size is a power of two\n"
+          "    for (size_t stride = get_local_size(0) / 2; stride > 0; stride /= 2) {\n"
+          "        if (lid < stride) {\n"
+          "            float s, e;\n"
+          "            two_sum(l_sum[lid], l_sum[lid + stride], &s, &e);\n"
+          "            l_sum[lid] = s;\n"
+          "            l_err[lid] += l_err[lid + stride] + e;\n"
+          "            l_min[lid] = fmin(l_min[lid], l_min[lid + stride]);\n"
+          "            l_max[lid] = fmax(l_max[lid], l_max[lid + stride]);\n"
+          "        }\n"
+          "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+          "    }\n"
+          "    if (lid == 0) {\n"
+          "        size_t group = get_group_id(0), groups = get_num_groups(0);\n"
+          "        partials[group] = l_sum[0];\n"
+          "        partials[groups + group] = l_err[0];\n"
+          "        partials[2 * groups + group] = l_min[0];\n"
+          "        partials[3 * groups + group] = l_max[0];\n"
+          "    }\n"
+          "}\n";
+}
+
+// reduce(x) and vecAdd_reduce(a, b, c), which stores c = a + b and reduces it in the same pass
+inline std::string source() {
+   const std::string locals = "                     __global float *partials,\n"
+                              "                     __local float *l_sum, __local float *l_err,\n"
+                              "                     __local float *l_min, __local float *l_max)\n";
+   return "// s + e == a + b exactly (Knuth's TwoSum)\n"
+          "inline void two_sum(float a, float b, float *s, float *e)\n"
+          "{\n"
+          "    *s = a + b;\n"
+          "    float bp = *s - a;\n"
+          "    *e = (a - (*s - bp)) + (b - bp);\n"
+          "}\n"
+          "\n"
+          "#define LOAD(i) x[i]\n"
+          "__kernel void reduce(__global const float *x, const unsigned int n,\n" + locals + reduce_body() +
+          "#undef LOAD\n"
+          "\n"
+          "#define LOAD(i) (c[i] = a[i] + b[i])\n"
+          "__kernel void vecAdd_reduce(__global const float *a, __global const float *b, __global float *c,\n"
+          "                     const unsigned int n,\n" + locals + reduce_body() +
+          "#undef LOAD\n";
+}
+
+/**
+ * Two-stage reduction: every work-group leaves its compensated partial sum,
+ * min and max in a small buffer, which is read back and combined in double
+ * on the host. Only 16 bytes per work-group cross the bus instead of the
+ * whole vector.
+ */
+class Reducer {
+public:
+   Reducer(cl_context context, cl_device_id device, clcache::ProgramCache &program_cache, cl_int *err) {
+      const std::string text = source();
+      program_ = program_cache.build(context, device, text.c_str(), "", err);
+      if (program_ == nullptr)
+         return;
+      reduce_ = clCreateKernel(program_, "reduce", err);
+      if (*err != CL_SUCCESS)
+         return;
+      add_reduce_ = clCreateKernel(program_, "vecAdd_reduce", err);
+      if (*err != CL_SUCCESS)
+         return;
+
+      // Largest power of two local size up to 256 that both kernels accept
+      size_t max_size = 256, kernel_max = 0;
+      for (cl_kernel kernel : {reduce_, add_reduce_}) {
+         clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernel_max), &kernel_max, nullptr);
+         max_size = std::min(max_size, std::max<size_t>(kernel_max, 1));
+      }
+      while (local_size_ * 2 <= max_size)
+         local_size_ *= 2;
+      cl_uint compute_units = 1;
+      clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(compute_units), &compute_units, nullptr);
+      max_groups_ = std::min<size_t>(1024, std::max<cl_uint>(compute_units, 1) * 8);
+      partials_ = clCreateBuffer(context, CL_MEM_WRITE_ONLY, 4 * max_groups_ * sizeof(float), nullptr, err);
+   }
+
+   Reducer(const Reducer &) = delete;
+   Reducer &operator=(const Reducer &) = delete;
+
+   ~Reducer() {
+      if (partials_ != nullptr) clReleaseMemObject(partials_);
+      if (add_reduce_ != nullptr) clReleaseKernel(add_reduce_);
+      if (reduce_ != nullptr) clReleaseKernel(reduce_);
+      if (program_ != nullptr) clReleaseProgram(program_);
+   }
+
+   // Sum, min and max of x[0, n); event (optional) receives the kernel's event
+   cl_int reduce(cl_command_queue queue, cl_mem x, unsigned int n, Result *result, cl_event *event = nullptr) {
+      cl_int err = clSetKernelArg(reduce_, 0, sizeof(cl_mem), &x);
+      err |= clSetKernelArg(reduce_, 1, sizeof(unsigned int), &n);
+      if (err != CL_SUCCESS)
+         return err;
+      return launch(queue, reduce_, 2, n, result, event);
+   }
+
+   // c = a + b and its sum, min and max in one kernel
+   cl_int add_reduce(cl_command_queue queue, cl_mem a, cl_mem b, cl_mem c, unsigned int n, Result *result,
+                     cl_event *event = nullptr) {
+      cl_int err = clSetKernelArg(add_reduce_, 0, sizeof(cl_mem), &a);
+      err |= clSetKernelArg(add_reduce_, 1, sizeof(cl_mem), &b);
+      err |= clSetKernelArg(add_reduce_, 2, sizeof(cl_mem), &c);
+      err |= clSetKernelArg(add_reduce_, 3, sizeof(unsigned int), &n);
+      if (err != CL_SUCCESS)
+         return err;
+      return launch(queue, add_reduce_, 4, n, result, event);
+   }
+
+private:
+   cl_int launch(cl_command_queue queue, cl_kernel kernel, cl_uint first_arg, unsigned int n, Result *result,
+                 cl_event *event) {
+      const size_t groups = std::max<size_t>(1, std::min(max_groups_, (n + local_size_ - 1) / local_size_));
+      cl_int err = clSetKernelArg(kernel, first_arg, sizeof(cl_mem), &partials_);
+      for (cl_uint local = 1; local <= 4; ++local)
+         err |= clSetKernelArg(kernel, first_arg + local, local_size_ * sizeof(float), nullptr);
+      if (err != CL_SUCCESS)
+         return err;
+      size_t global_size = groups * local_size_;
+      err = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &global_size, &local_size_, 0, nullptr, event);
+      if (err != CL_SUCCESS)
+         return err;
+
+      std::vector<float> partials(4 * groups);
+      err = clEnqueueReadBuffer(queue, partials_, CL_TRUE, 0, partials.size() * sizeof(float), partials.data(),
+                                0, nullptr, nullptr);
+      if (err != CL_SUCCESS)
+         return err;
+      *result = Result();
+      for (size_t group = 0; group < groups; ++group) {
+         result->sum += static_cast<double>(partials[group]) + partials[groups + group];
+         result->min = std::min(result->min, partials[2 * groups + group]);
+         result->max = std::max(result->max, partials[3 * groups + group]);
+      }
+      return CL_SUCCESS;
+   }
+
+   cl_program program_ = nullptr;
+   cl_kernel reduce_ = nullptr;
+   cl_kernel add_reduce_ = nullptr;
+   cl_mem partials_ = nullptr;
+   size_t local_size_ = 1;
+   size_t max_groups_ = 1;
+};
+
+}
+
+#endif
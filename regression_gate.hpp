@@ -0,0 +1,133 @@
+//
+// Regression gate: compares a run's timing samples with a stored baseline.
+//
+
+#ifndef REGRESSION_GATE_HPP
+#define REGRESSION_GATE_HPP
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "bench_report.hpp"
+#include "bench_stats.hpp"
+
+namespace benchgate {
+
+struct Options {
+   double threshold = 0.05;  // relative slowdown of the median that counts as a regression
+   double alpha = 0.05;      // significance level of the Mann-Whitney test
+};
+
+// Smallest p-value mann_whitney_p can return for n1 and n2 samples: the two sides entirely apart
+inline double smallest_p(size_t n1, size_t n2) {
+   std::vector<double> a, b;
+   for (size_t i = 0; i < n1; ++i) a.push_back(static_cast<double>(i));
+   for (size_t i = 0; i < n2; ++i) b.push_back(static_cast<double>(n1 + i));
+   return benchstats::mann_whitney_p(a, b);
+}
+
+// Samples per side needed before a difference can be significant at alpha
+inline int min_samples(double alpha) {
+   int samples = 2;
+   while (samples < 1000 && smallest_p(samples, samples) >= alpha)
+      ++samples;
+   return samples;
+}
+
+/**
+ * Match every current record with the baseline record of the same device
+ * and configuration, then test each metric's samples. A metric regresses
+ * when its median is more than threshold slower and the difference is
+ * significant; faster metrics are reported but never fail the gate.
+ * Metrics with too few samples to ever reach alpha, and device and
+ * configuration pairs that occur more than once on either side, are errors
+ * rather than passes. Prints one line per metric and returns the number of
+ * regressions plus errors, or 1 when nothing could be compared at all.
+ */
+inline int compare(const std::vector<benchreport::Record> &baseline, const std::vector<benchreport::Record> &current,
+                   const Options &options) {
+   int regressions = 0, matched = 0, errors = 0;
+   std::ios_base::fmtflags flags = std::cout.flags();
+   std::streamsize precision = std::cout.precision();
+   auto same_key = [](const benchreport::Record &a, const benchreport::Record &b) {
+      return a.device.name == b.device.name &&
+             benchreport::Report::config_string(a) == benchreport::Report::config_string(b);
+   };
+   for (size_t r = 0; r < current.size(); ++r) {
+      const benchreport::Record &record = current[r];
+      const std::string config = benchreport::Report::config_string(record);
+      const benchreport::Record *reference = nullptr;
+      int references = 0;
+      for (const benchreport::Record &candidate : baseline)
+         if (same_key(candidate, record)) {
+            reference = &candidate;
+            ++references;
+         }
+      bool repeated = false;
+      for (size_t earlier = 0; earlier < r; ++earlier)
+         repeated = repeated || same_key(current[earlier], record);
+      std::cout << record.device.name << " [" << config << "]" << std::endl;
+      if (repeated || references > 1) {
+         std::cout << "  ERROR: " << (repeated ? "this run" : "the baseline")
+                   << " has more than one record for this device and configuration" << std::endl;
+         ++errors;
+         continue;
+      }
+      if (reference == nullptr) {
+         std::cout << "  no baseline for this device and configuration" << std::endl;
+         continue;
+      }
+      if (reference->device.driver_version != record.device.driver_version)
+         std::cout << "  driver " << reference->device.driver_version << " -> " << record.device.driver_version
+                   << std::endl;
+      std::cout << "  " << std::left << std::setw(12) << "metric (ms)" << std::right << std::setw(12) << "baseline"
+                << std::setw(12) << "current" << std::setw(10) << "change" << std::setw(10) << "p" << "  verdict"
+                << std::endl;
+      for (auto &metric : record.samples) {
+         const std::vector<double> *before = nullptr;
+         for (auto &candidate : reference->samples)
+            if (candidate.first == metric.first)
+               before = &candidate.second;
+         if (before == nullptr || before->empty() || metric.second.empty())
+            continue;
+         ++matched;
+         if (smallest_p(before->size(), metric.second.size()) >= options.alpha) {
+            std::cout << "  " << std::left << std::setw(12) << metric.first << std::right << "  ERROR: "
+                      << before->size() << " baseline and " << metric.second.size()
+                      << " current samples cannot reach alpha " << options.alpha << std::endl;
+            ++errors;
+            continue;
+         }
+         const double old_median = benchstats::summarize(*before).median;
+         const double new_median = benchstats::summarize(metric.second).median;
+         const double change = old_median > 0 ? new_median / old_median - 1 : 0;
+         const double p = benchstats::mann_whitney_p(*before, metric.second);
+         const char *verdict = "same";
+         if (p < options.alpha && change > options.threshold) {
+            verdict = "REGRESSION";
+            ++regressions;
+         } else if (p < options.alpha && change < -options.threshold) {
+            verdict = "faster";
+         }
+         std::cout << "  " << std::left << std::setw(12) << metric.first << std::right << std::fixed
+                   << std::setprecision(3) << std::setw(12) << old_median << std::setw(12) << new_median
+                   << std::setw(9) << std::showpos << change * 100 << std::noshowpos << "%" << std::setprecision(4)
+                   << std::setw(10) << p << "  " << verdict << std::endl;
+      }
+   }
+   std::cout.flags(flags);
+   std::cout.precision(precision);
+   if (matched == 0)
+      std::cout << "No metric matched the baseline; rerun with the options that produced it" << std::endl;
+   std::cout << "Regression check: " << regressions << " of " << matched << " metrics regressed by more than "
+             << options.threshold * 100 << "% (alpha " << options.alpha << ")";
+   if (errors)
+      std::cout << ", " << errors << " could not be checked";
+   std::cout << std::endl;
+   return matched ? regressions + errors : 1;
+}
+
+}
+
+#endif
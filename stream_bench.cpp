@@ -0,0 +1,230 @@
+//
+// STREAM-style copy/scale/add/triad bandwidth sweep over every OpenCL device.
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+#include "bench_stats.hpp"
+#include "program_cache.hpp"
+
+// The four STREAM kernels (McCalpin), one float element per work item
+const char *streamSource =
+        "__kernel void copy(__global const float *a, __global float *c, const unsigned int n)\n"
+        "{\n"
+        "    size_t i = get_global_id(0);\n"
+        "    if (i < n)\n"
+        "        c[i] = a[i];\n"
+        "}\n"
+        "\n"
+        "__kernel void scale(__global float *b, __global const float *c, const float s, const unsigned int n)\n"
+        "{\n"
+        "    size_t i = get_global_id(0);\n"
+        "    if (i < n)\n"
+        "        b[i] = s * c[i];\n"
+        "}\n"
+        "\n"
+        "__kernel void add(__global const float *a, __global const float *b, __global float *c, const unsigned int n)\n"
+        "{\n"
+        "    size_t i = get_global_id(0);\n"
+        "    if (i < n)\n"
+        "        c[i] = a[i] + b[i];\n"
+        "}\n"
+        "\n"
+        "__kernel void triad(__global float *a, __global const float *b, __global const float *c, const float s,\n"
+        "                    const unsigned int n)\n"
+        "{\n"
+        "    size_t i = get_global_id(0);\n"
+        "    if (i < n)\n"
+        "        a[i] = b[i] + s * c[i];\n"
+        "}\n";
+
+struct StreamKernel {
+   const char *name;
+   int arrays;           // arrays read plus written per element, for the bandwidth figure
+   int buffers[3];       // indices into {a, b, c}, -1 when unused
+   bool scalar;          // takes s right after the arrays
+};
+
+const StreamKernel stream_kernels[] = {
+        {"copy",  2, {0, 2, -1}, false},
+        {"scale", 2, {1, 2, -1}, true},
+        {"add",   3, {0, 1, 2},  false},
+        {"triad", 3, {0, 1, 2},  true},
+};
+const int NUM_OF_STREAM_KERNELS = sizeof(stream_kernels) / sizeof(stream_kernels[0]);
+
+// Device time of every repeat of one kernel over n elements, in nanoseconds
+std::vector<double> time_kernel(cl_command_queue queue, cl_kernel kernel, const StreamKernel &info,
+                                cl_mem buffers[3], unsigned int n, int repeats, cl_int *err) {
+   const float s = 3.0f;
+   cl_uint index = 0;
+   *err = CL_SUCCESS;
+   for (int buffer : info.buffers) {
+      if (buffer < 0)
+         break;
+      *err |= clSetKernelArg(kernel, index++, sizeof(cl_mem), &buffers[buffer]);
+   }
+   if (info.scalar)
+      *err |= clSetKernelArg(kernel, index++, sizeof(float), &s);
+   *err |= clSetKernelArg(kernel, index, sizeof(unsigned int), &n);
+
+   std::vector<double> samples;
+   size_t global_size = n;
+   // one untimed launch first, so the sample excludes first-use costs
+   for (int repeat = 0; repeat <= repeats && *err == CL_SUCCESS; ++repeat) {
+      cl_event event = nullptr;
+      *err = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &global_size, nullptr, 0, nullptr, &event);
+      if (*err == CL_SUCCESS)
+         *err = clWaitForEvents(1, &event);
+      cl_ulong start = 0, end = 0;
+      if (*err == CL_SUCCESS) {
+         clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+         clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+         if (repeat > 0)
+            samples.push_back(static_cast<double>(end - start));
+      }
+      if (event != nullptr) clReleaseEvent(event);
+   }
+   return samples;
+}
+
+// Sweep one device from min_bytes per array up to its allocation limit (or max_bytes), factor apart
+int sweep_device(cl_device_id device, clcache::ProgramCache &program_cache, size_t min_bytes, size_t max_bytes,
+                 double factor, int repeats) {
+   const std::string name = clcache::device_string(device, CL_DEVICE_NAME);
+   cl_ulong max_alloc = 0, global_mem = 0;
+   clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, nullptr);
+   clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, nullptr);
+   // three arrays have to fit at once, and n is an unsigned int in the kernels
+   size_t largest = static_cast<size_t>(std::min<cl_ulong>(max_alloc, global_mem / 4));
+   largest = std::min<size_t>(largest, static_cast<size_t>(0xffffffffu) * sizeof(float));
+   if (max_bytes)
+      largest = std::min(largest, max_bytes);
+   largest = largest / sizeof(float) * sizeof(float);
+   std::cout << "Device " << name << ": " << min_bytes << " to " << largest << " bytes per array" << std::endl;
+
+   cl_int err;
+   cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &err);
+   if (err != CL_SUCCESS) {
+      std::cout << "Create context failed" << std::endl;
+      return -1;
+   }
+   cl_command_queue queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+   cl_program program = nullptr;
+   if (err == CL_SUCCESS)
+      program = program_cache.build(context, device, streamSource, "", &err);
+   std::vector<cl_kernel> kernels;
+   for (int k = 0; k < NUM_OF_STREAM_KERNELS && err == CL_SUCCESS; ++k)
+      kernels.push_back(clCreateKernel(program, stream_kernels[k].name, &err));
+   // the largest arrays are allocated once and every size runs on a prefix of them
+   cl_mem buffers[3] = {nullptr, nullptr, nullptr};
+   const float initial[3] = {1.0f, 2.0f, 0.0f};
+   for (int k = 0; k < 3 && err == CL_SUCCESS; ++k) {
+      buffers[k] = clCreateBuffer(context, CL_MEM_READ_WRITE, largest, nullptr, &err);
+      if (err == CL_SUCCESS)
+         err = clEnqueueFillBuffer(queue, buffers[k], &initial[k], sizeof(float), 0, largest, 0, nullptr, nullptr);
+   }
+   if (err == CL_SUCCESS)
+      err = clFinish(queue);
+
+   int status = 0;
+   if (err != CL_SUCCESS) {
+      std::cout << "Setting up " << name << " failed with error " << err << std::endl;
+      status = -1;
+   } else {
+      std::streamsize precision = std::cout.precision();
+      std::cout << std::setw(14) << "bytes/array";
+      for (const StreamKernel &info : stream_kernels)
+         std::cout << std::setw(12) << std::string(info.name) + " GB/s";
+      std::cout << std::endl;
+      for (double bytes = static_cast<double>(min_bytes); ; bytes *= factor) {
+         const size_t size = std::min(static_cast<size_t>(bytes) / sizeof(float) * sizeof(float), largest);
+         const unsigned int n = static_cast<unsigned int>(size / sizeof(float));
+         std::cout << std::setw(14) << size;
+         for (int k = 0; k < NUM_OF_STREAM_KERNELS; ++k) {
+            std::vector<double> samples = time_kernel(queue, kernels[k], stream_kernels[k], buffers, n, repeats, &err);
+            if (err != CL_SUCCESS) {
+               std::cout << std::setw(12) << "error";
+               status = -1;
+               continue;
+            }
+            // STREAM reports the best repeat
+            benchstats::Summary summary = benchstats::summarize(samples);
+            double gb_per_s = summary.min > 0 ? stream_kernels[k].arrays * static_cast<double>(size) / summary.min : 0;
+            std::cout << std::setw(12) << std::fixed << std::setprecision(2) << gb_per_s;
+         }
+         std::cout.unsetf(std::ios::fixed);
+         std::cout.precision(precision);
+         std::cout << std::endl;
+         if (size >= largest)
+            break;
+      }
+   }
+
+   for (cl_mem buffer : buffers)
+      if (buffer != nullptr) clReleaseMemObject(buffer);
+   for (cl_kernel kernel : kernels)
+      if (kernel != nullptr) clReleaseKernel(kernel);
+   if (program != nullptr) clReleaseProgram(program);
+   if (queue != nullptr) clReleaseCommandQueue(queue);
+   clReleaseContext(context);
+   return status;
+}
+
+int main(int argc, char *argv[]) {
+   // --min-bytes B / --max-bytes B: bytes per array at both ends of the sweep, 0 = device limit
+   // --factor F: ratio between consecutive sizes; --repeats R: timed launches per kernel and size
+   size_t min_bytes = 1024, max_bytes = 0;
+   double factor = 2;
+   int repeats = 10;
+   std::string cache_dir = ".clcache";
+   for (int arg = 1; arg < argc; ++arg) {
+      std::string option(argv[arg]);
+      if (option == "--min-bytes" && arg + 1 < argc) {
+         min_bytes = std::max<size_t>(sizeof(float), strtoull(argv[++arg], nullptr, 10));
+      } else if (option == "--max-bytes" && arg + 1 < argc) {
+         max_bytes = strtoull(argv[++arg], nullptr, 10);
+      } else if (option == "--factor" && arg + 1 < argc) {
+         factor = std::max(1.1, atof(argv[++arg]));
+      } else if (option == "--repeats" && arg + 1 < argc) {
+         repeats = std::max(1, atoi(argv[++arg]));
+      } else if (option == "--cache-dir" && arg + 1 < argc) {
+         cache_dir = argv[++arg];
+      } else if (option == "--no-cache") {
+         cache_dir.clear();
+      } else {
+         std::cout << "Unknown option " << option << std::endl;
+         std::cout << "Usage: " << argv[0] << " [--min-bytes B] [--max-bytes B] [--factor F] [--repeats R]"
+                   << " [--cache-dir DIR | --no-cache]" << std::endl;
+         return -1;
+      }
+   }
+   clcache::ProgramCache program_cache(cache_dir);
+
+   cl_uint num_pltfs = 0;
+   if (clGetPlatformIDs(0, nullptr, &num_pltfs) != CL_SUCCESS || num_pltfs == 0) {
+      std::cout << "Cannot get platform" << std::endl;
+      return -1;
+   }
+   std::vector<cl_platform_id> platforms(num_pltfs);
+   clGetPlatformIDs(num_pltfs, platforms.data(), nullptr);
+
+   int status = 0;
+   for (cl_platform_id platform : platforms) {
+      cl_uint num_devs = 0;
+      if (clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &num_devs) != CL_SUCCESS || num_devs == 0)
+         continue;
+      std::vector<cl_device_id> devices(num_devs);
+      clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, num_devs, devices.data(), nullptr);
+      for (cl_device_id device : devices)
+         if (sweep_device(device, program_cache, min_bytes, max_bytes, factor, repeats) != 0)
+            status = -1;
+   }
+   program_cache.print_stats();
+   return status;
+}
@@ -0,0 +1,182 @@
+//
+// Chunked vector addition that overlaps upload, compute and download.
+//
+
+#ifndef STREAM_PIPELINE_HPP
+#define STREAM_PIPELINE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <CL/opencl.h>
+#include "cl_profile.hpp"
+#include "kernel_gen.hpp"
+
+namespace clstream {
+
+// Device time spent per stage during the last run, in nanoseconds
+struct Stats {
+   size_t chunks = 0;
+   cl_ulong upload_ns = 0;
+   cl_ulong compute_ns = 0;
+   cl_ulong download_ns = 0;
+};
+
+/**
+ * Streams c = a + b through `depth` rotating sets of chunk sized device
+ * buffers. Uploads, kernels and downloads go to three in-order queues and
+ * are chained with events, so the upload of chunk k+1, the kernel of chunk
+ * k and the download of chunk k-1 can run at the same time. Only
+ * 3 * depth chunks are resident on the device, so n is not limited by
+ * CL_DEVICE_MAX_MEM_ALLOC_SIZE.
+ */
+class Pipeline {
+public:
+   Pipeline(cl_context context, cl_device_id device, cl_kernel kernel, const clkernels::Variant &variant,
+            size_t chunk_elements, int depth, cl_command_queue_properties properties, cl_int *err)
+           : kernel_(kernel), variant_(variant), chunk_(chunk_elements), depth_(std::max(2, depth)),
+             profiling_((properties & CL_QUEUE_PROFILING_ENABLE) != 0) {
+      *err = CL_SUCCESS;
+      for (auto &queue : queues_) {
+         queue = clCreateCommandQueue(context, device, properties, err);
+         if (*err != CL_SUCCESS)
+            return;
+      }
+      const size_t bytes = chunk_ * sizeof(float);
+      for (int slot = 0; slot < depth_; ++slot) {
+         a_.push_back(clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, nullptr, err));
+         if (*err != CL_SUCCESS) return;
+         b_.push_back(clCreateBuffer(context, CL_MEM_READ_ONLY, bytes, nullptr, err));
+         if (*err != CL_SUCCESS) return;
+         c_.push_back(clCreateBuffer(context, CL_MEM_WRITE_ONLY, bytes, nullptr, err));
+         if (*err != CL_SUCCESS) return;
+      }
+   }
+
+   Pipeline(const Pipeline &) = delete;
+   Pipeline &operator=(const Pipeline &) = delete;
+
+   ~Pipeline() {
+      for (auto buffers : {&a_, &b_, &c_})
+         for (cl_mem buffer : *buffers)
+            if (buffer != nullptr) clReleaseMemObject(buffer);
+      for (auto queue : queues_)
+         if (queue != nullptr) clReleaseCommandQueue(queue);
+   }
+
+   size_t chunk_elements() const { return chunk_; }
+   const Stats &stats() const { return stats_; }
+
+   // Compute c[0, n) = a + b with the kernel built from variant; local_size 0 means NULL.
+   cl_int run(const float *a, const float *b, float *c, unsigned int n, size_t local_size) {
+      stats_ = Stats();
+      const size_t chunks = (n + chunk_ - 1) / chunk_;
+      // All events of this run; download[k] guards reuse of slot k % depth by chunk k + depth
+      std::vector<cl_event> uploads(chunks, nullptr), computes(chunks, nullptr), downloads(chunks, nullptr);
+      std::vector<cl_event> writes_a(chunks, nullptr);
+      cl_int err = CL_SUCCESS;
+
+      for (size_t k = 0; k < chunks && err == CL_SUCCESS; ++k) {
+         const int slot = static_cast<int>(k % depth_);
+         const size_t offset = k * chunk_;
+         const unsigned int count = static_cast<unsigned int>(std::min(chunk_, n - offset));
+         const size_t bytes = count * sizeof(float);
+
+         // Upload chunk k once the slot's previous occupant has been downloaded
+         cl_uint reuse_waits = k >= static_cast<size_t>(depth_) ? 1 : 0;
+         const cl_event *reuse = reuse_waits ? &downloads[k - depth_] : nullptr;
+         err = clEnqueueWriteBuffer(queues_[0], a_[slot], CL_FALSE, 0, bytes, a + offset,
+                                    reuse_waits, reuse, &writes_a[k]);
+         err |= clEnqueueWriteBuffer(queues_[0], b_[slot], CL_FALSE, 0, bytes, b + offset,
+                                     reuse_waits, reuse, &uploads[k]);
+         if (err != CL_SUCCESS) break;
+
+         // Compute chunk k after its upload
+         size_t global_size = variant_.global_size(count, local_size);
+         err = clSetKernelArg(kernel_, 0, sizeof(cl_mem), &a_[slot]);
+         err |= clSetKernelArg(kernel_, 1, sizeof(cl_mem), &b_[slot]);
+         err |= clSetKernelArg(kernel_, 2, sizeof(cl_mem), &c_[slot]);
+         err |= clSetKernelArg(kernel_, 3, sizeof(unsigned int), &count);
+         err |= clEnqueueNDRangeKernel(queues_[1], kernel_, 1, nullptr, &global_size,
+                                       local_size ? &local_size : nullptr, 1, &uploads[k], &computes[k]);
+         if (err != CL_SUCCESS) break;
+
+         // Download chunk k after its kernel
+         err = clEnqueueReadBuffer(queues_[2], c_[slot], CL_FALSE, 0, bytes, c + offset,
+                                   1, &computes[k], &downloads[k]);
+         for (auto queue : queues_)
+            clFlush(queue);
+      }
+      for (auto queue : queues_)
+         clFinish(queue);
+
+      stats_.chunks = chunks;
+      for (size_t k = 0; k < chunks; ++k) {
+         if (profiling_ && err == CL_SUCCESS) {
+            stats_.upload_ns += clprofile::event_duration(writes_a[k]) + clprofile::event_duration(uploads[k]);
+            stats_.compute_ns += clprofile::event_duration(computes[k]);
+            stats_.download_ns += clprofile::event_duration(downloads[k]);
+         }
+         for (cl_event event : {writes_a[k], uploads[k], computes[k], downloads[k]})
+            if (event != nullptr) clReleaseEvent(event);
+      }
+      return err;
+   }
+
+private:
+   cl_kernel kernel_;
+   clkernels::Variant variant_;
+   size_t chunk_;
+   int depth_;
+   bool profiling_;
+   cl_command_queue queues_[3] = {nullptr, nullptr, nullptr};  // upload, compute, download
+   std::vector<cl_mem> a_, b_, c_;
+   Stats stats_;
+};
+
+// Largest chunk the device can allocate, in elements
+inline size_t max_chunk_elements(cl_device_id device) {
+   cl_ulong max_alloc = 0;
+   clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, nullptr);
+   return std::max<size_t>(1, static_cast<size_t>(max_alloc / sizeof(float)));
+}
+
+/**
+ * Pick the chunk size with the lowest wall time for streaming a prefix of
+ * the vectors. Candidates grow by 4x from 64K elements up to n or the
+ * device allocation limit; the prefix holds eight of the largest chunks.
+ */
+inline size_t tune_chunk(cl_context context, cl_device_id device, cl_kernel kernel, const clkernels::Variant &variant,
+                         const float *a, const float *b, float *c, unsigned int n, size_t local_size, int depth) {
+   const size_t largest = std::min<size_t>(n, max_chunk_elements(device));
+   std::vector<size_t> candidates;
+   for (size_t chunk = 1 << 16; chunk < largest; chunk *= 4)
+      candidates.push_back(chunk);
+   candidates.push_back(largest);
+   const unsigned int prefix = static_cast<unsigned int>(std::min<size_t>(n, 8 * candidates.back()));
+
+   size_t best_chunk = candidates.back();
+   double best_ms = -1;
+   for (size_t chunk : candidates) {
+      cl_int err;
+      Pipeline pipeline(context, device, kernel, variant, chunk, depth, 0, &err);
+      // one untimed pass so first-touch and allocation costs do not favour later candidates
+      if (err != CL_SUCCESS || pipeline.run(a, b, c, prefix, local_size) != CL_SUCCESS)
+         continue;
+      auto begin = std::chrono::steady_clock::now();
+      if (pipeline.run(a, b, c, prefix, local_size) != CL_SUCCESS)
+         continue;
+      double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+      std::cout << "  chunk " << chunk << " elements: " << ms << " ms" << std::endl;
+      if (best_ms < 0 || ms < best_ms) {
+         best_ms = ms;
+         best_chunk = chunk;
+      }
+   }
+   return best_chunk;
+}
+
+}
+
+#endif
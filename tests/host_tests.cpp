@@ -0,0 +1,209 @@
+//
+// Checks of the host-side logic that needs no OpenCL device: half conversion, chunk queue, pool size classes,
+// arena ranges, report CSV round trip and the Mann-Whitney test.
+//
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+#include <CL/opencl.h>
+#include "bench_report.hpp"
+#include "bench_stats.hpp"
+#include "buffer_arena.hpp"
+#include "chunk_scheduler.hpp"
+#include "cl_raii.hpp"
+#include "vec_kernel.hpp"
+
+int failures = 0;
+
+#define CHECK(condition)                                                               \
+   do {                                                                                \
+      if (!(condition)) {                                                              \
+         std::cout << __FILE__ << ":" << __LINE__ << ": " #condition " failed" << std::endl; \
+         ++failures;                                                                   \
+      }                                                                                \
+   } while (0)
+
+void test_half() {
+   using clkernels::float_to_half;
+   using clkernels::half_to_float;
+   CHECK(float_to_half(1.0f) == 0x3c00);
+   CHECK(float_to_half(-2.0f) == 0xc000);
+   CHECK(float_to_half(65504.0f) == 0x7bff);
+   CHECK(float_to_half(65520.0f) == 0x7c00);                       // rounds past the largest half
+   CHECK(float_to_half(std::ldexp(1.0f, -24)) == 0x0001);          // smallest subnormal
+   CHECK(float_to_half(std::ldexp(1.0f, -25)) == 0x0000);          // halfway, ties to even
+   CHECK(float_to_half(1.0f + std::ldexp(1.0f, -11)) == 0x3c00);   // halfway, ties to even
+   CHECK(float_to_half(1.0f + 3 * std::ldexp(1.0f, -11)) == 0x3c02);
+   CHECK(float_to_half(std::numeric_limits<float>::infinity()) == 0x7c00);
+   const cl_half nan = float_to_half(std::numeric_limits<float>::quiet_NaN());
+   CHECK((nan & 0x7c00) == 0x7c00 && (nan & 0x3ff) != 0);
+   // every half that is a number survives the round trip through float
+   for (unsigned bits = 0; bits <= 0xffff; ++bits) {
+      const cl_half half = static_cast<cl_half>(bits);
+      const float value = half_to_float(half);
+      if ((bits & 0x7c00) == 0x7c00 && (bits & 0x3ff) != 0)
+         CHECK(std::isnan(value));
+      else
+         CHECK(float_to_half(value) == half);
+   }
+}
+
+void test_guided_queue() {
+   // one consumer: chunks are contiguous, shrink towards the end and stay within bounds
+   clsched::GuidedQueue queue(1000000, 4, 1000, 100000);
+   size_t offset, count, expected = 0, previous = 100000;
+   while (queue.next(offset, count)) {
+      CHECK(offset == expected);
+      CHECK(count <= 100000 && count <= previous);
+      CHECK(count >= 1000 || offset + count == 1000000);
+      expected = offset + count;
+      previous = count;
+   }
+   CHECK(expected == 1000000);
+
+   // several consumers: every element is claimed exactly once
+   const size_t n = 1 << 20;
+   clsched::GuidedQueue shared(n, 8, 1, 4096);
+   std::vector<std::atomic<int>> claimed(n);
+   for (auto &element : claimed)
+      element = 0;
+   std::vector<std::thread> threads;
+   for (int t = 0; t < 8; ++t)
+      threads.emplace_back([&]() {
+         size_t first, size;
+         while (shared.next(first, size))
+            for (size_t i = first; i < first + size; ++i)
+               claimed[i]++;
+      });
+   for (auto &thread : threads)
+      thread.join();
+   size_t wrong = 0;
+   for (auto &element : claimed)
+      wrong += element != 1;
+   CHECK(wrong == 0);
+}
+
+void test_size_class() {
+   CHECK(clwrap::size_class(1) == 64);
+   CHECK(clwrap::size_class(64) == 64);
+   CHECK(clwrap::size_class(65) == 80);
+   CHECK(clwrap::size_class(100) == 112);
+   CHECK(clwrap::size_class(1000) == 1024);
+   CHECK(clwrap::size_class(1025) == 1280);
+   for (size_t bytes = 64; bytes < (1 << 20); bytes = bytes * 5 / 4 + 1) {
+      const size_t size = clwrap::size_class(bytes);
+      CHECK(size >= bytes && size <= bytes + bytes / 4);
+      CHECK(clwrap::size_class(size) == size);
+   }
+}
+
+void test_arena_ranges() {
+   clarena::Ranges ranges(1024, clarena::Strategy::free_list);
+   size_t origins[4];
+   for (size_t &origin : origins)
+      CHECK(ranges.reserve(256, &origin));
+   CHECK(origins[0] == 0 && origins[1] == 256 && origins[2] == 512 && origins[3] == 768);
+   size_t origin;
+   CHECK(!ranges.reserve(1, &origin));
+   ranges.release(256, 256);
+   ranges.release(768, 256);
+   CHECK(ranges.pieces() == 2 && ranges.free_bytes() == 512 && ranges.largest_free() == 256);
+   CHECK(!ranges.reserve(512, &origin));
+   ranges.release(512, 256);  // merges with both neighbours
+   CHECK(ranges.pieces() == 1 && ranges.largest_free() == 768);
+   CHECK(ranges.reserve(512, &origin) && origin == 256);
+   ranges.release(256, 512);
+   ranges.release(0, 256);
+   CHECK(ranges.pieces() == 1 && ranges.largest_free() == 1024);
+
+   clarena::Ranges bump(1024, clarena::Strategy::bump);
+   CHECK(bump.reserve(512, &origins[0]) && bump.reserve(256, &origins[1]));
+   bump.release(origins[0], 512);
+   CHECK(bump.largest_free() == 256);  // freed space waits until the arena is empty
+   bump.release(origins[1], 256);
+   CHECK(bump.largest_free() == 1024);
+}
+
+void test_csv_round_trip() {
+   const std::string path = "host_tests.csv";
+   benchreport::Report report("host_tests");
+   benchreport::DeviceInfo device;
+   device.name = "Board \"X\", rev 2 [0:1]";
+   device.vendor = "Vendor";
+   device.type = "GPU";
+   device.driver_version = "1.2.3";
+   benchreport::Record &first = report.add(device);
+   first.set("mode", "copy");
+   first.set("n", "1000");
+   first.add("kernel", {1.5, 0.25, 3});
+   first.add("end-to-end", {2, 4});
+   benchreport::Record &second = report.add(benchreport::host_device("Native host"));
+   second.set("mode", "native");
+   second.add("end-to-end", {0.125});
+   CHECK(report.write_csv(path));
+
+   std::vector<benchreport::Record> records;
+   CHECK(benchreport::read_csv(path, &records));
+   CHECK(records.size() == 2);
+   if (records.size() == 2) {
+      CHECK(records[0].device.name == device.name && records[0].device.driver_version == "1.2.3");
+      CHECK(benchreport::Report::config_string(records[0]) == benchreport::Report::config_string(report.records()[0]));
+      CHECK(records[0].samples == report.records()[0].samples);
+      CHECK(records[1].device.name == "Native host" && records[1].samples == report.records()[1].samples);
+   }
+
+   // the same device and configuration twice is refused
+   benchreport::Record &again = report.add(device);
+   again.set("mode", "copy");
+   again.set("n", "1000");
+   again.add("kernel", {1});
+   CHECK(report.write_csv(path));
+   records.clear();
+   CHECK(!benchreport::read_csv(path, &records));
+   std::remove(path.c_str());
+}
+
+void test_mann_whitney() {
+   const std::vector<double> same(10, 1.0);
+   CHECK(benchstats::mann_whitney_p(same, same) == 1);
+   CHECK(benchstats::mann_whitney_p({}, same) == 1);
+   std::vector<double> low, high;
+   for (int i = 0; i < 10; ++i) {
+      low.push_back(i);
+      high.push_back(100 + i);
+   }
+   const double p = benchstats::mann_whitney_p(low, high);
+   CHECK(p > 1.5e-4 && p < 2.0e-4);  // U = 0: z = 49.5 / sqrt(175)
+   CHECK(p == benchstats::mann_whitney_p(high, low));
+   // interleaved samples are indistinguishable
+   std::vector<double> even, odd;
+   for (int i = 0; i < 20; i += 2) {
+      even.push_back(i);
+      odd.push_back(i + 1);
+   }
+   CHECK(benchstats::mann_whitney_p(even, odd) > 0.5);
+   // three against three can never get below 0.05
+   CHECK(benchstats::mann_whitney_p({1, 2, 3}, {4, 5, 6}) > 0.05);
+}
+
+int main() {
+   test_half();
+   test_guided_queue();
+   test_size_class();
+   test_arena_ranges();
+   test_csv_round_trip();
+   test_mann_whitney();
+   if (failures) {
+      std::cout << failures << " checks failed" << std::endl;
+      return 1;
+   }
+   std::cout << "All host checks passed" << std::endl;
+   return 0;
+}
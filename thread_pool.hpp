@@ -0,0 +1,151 @@
+//
+// Persistent host thread pool for data-parallel loops.
+//
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace hostpool {
+
+// fn(begin, end, worker) processes elements [begin, end) on worker 0 .. size() - 1
+typedef std::function<void(size_t begin, size_t end, unsigned worker)> RangeFunction;
+
+/**
+ * Fixed set of threads that split one index range at a time into
+ * contiguous, cache line aligned slices, one per thread. The calling thread
+ * works on slice 0, so a pool of size 1 starts no threads at all. Slice k
+ * always goes to the same thread, which keeps first-touch placement and
+ * later accesses on the same core. A pinned pool runs every slice on its
+ * own thread bound to one CPU (Linux), so the pages a slice first touched
+ * stay on that CPU's NUMA node; the caller only waits.
+ */
+class ThreadPool {
+public:
+   // 0 threads means std::thread::hardware_concurrency()
+   explicit ThreadPool(unsigned threads = 0, bool pinned = false) : first_thread_(pinned ? 0 : 1) {
+      size_ = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+      for (unsigned worker = first_thread_; worker < size_; ++worker)
+         threads_.emplace_back([this, worker, pinned]() {
+            if (pinned)
+               pin(worker);
+            work(worker);
+         });
+   }
+
+   ThreadPool(const ThreadPool &) = delete;
+   ThreadPool &operator=(const ThreadPool &) = delete;
+
+   ~ThreadPool() {
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         stop_ = true;
+      }
+      start_.notify_all();
+      for (auto &thread : threads_)
+         thread.join();
+   }
+
+   unsigned size() const { return size_; }
+
+   // Slice of [0, n) owned by worker; boundaries are multiples of 16 elements
+   void slice(size_t n, unsigned worker, size_t *begin, size_t *end) const {
+      auto boundary = [&](unsigned k) {
+         return k >= size_ ? n : std::min(n, (n / size_ * k) / 16 * 16);
+      };
+      *begin = boundary(worker);
+      *end = boundary(worker + 1);
+   }
+
+   // Run fn over [0, n) on every thread and wait for all of them
+   void parallel_for(size_t n, const RangeFunction &fn) {
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         task_ = &fn;
+         n_ = n;
+         pending_ = size_ - first_thread_;
+         ++generation_;
+      }
+      start_.notify_all();
+      size_t begin, end;
+      slice(n, 0, &begin, &end);
+      if (first_thread_ == 1 && begin < end)
+         fn(begin, end, 0);
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_.wait(lock, [this]() { return pending_ == 0; });
+      task_ = nullptr;
+   }
+
+private:
+   // Bind the calling thread to the worker-th CPU it may run on
+   static void pin(unsigned worker) {
+#ifdef __linux__
+      cpu_set_t allowed;
+      if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+         return;
+      unsigned target = worker % CPU_COUNT(&allowed);
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+         if (!CPU_ISSET(cpu, &allowed) || target-- != 0)
+            continue;
+         cpu_set_t one;
+         CPU_ZERO(&one);
+         CPU_SET(cpu, &one);
+         pthread_setaffinity_np(pthread_self(), sizeof(one), &one);
+         return;
+      }
+#else
+      (void) worker;
+#endif
+   }
+
+   void work(unsigned worker) {
+      size_t seen = 0;
+      for (;;) {
+         const RangeFunction *task;
+         size_t n;
+         {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+            if (stop_)
+               return;
+            seen = generation_;
+            task = task_;
+            n = n_;
+         }
+         size_t begin, end;
+         slice(n, worker, &begin, &end);
+         if (begin < end)
+            (*task)(begin, end, worker);
+         {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0)
+               done_.notify_one();
+         }
+      }
+   }
+
+   unsigned size_;
+   const unsigned first_thread_;  // 0 when slice 0 has its own thread too
+   std::vector<std::thread> threads_;
+   std::mutex mutex_;
+   std::condition_variable start_, done_;
+   const RangeFunction *task_ = nullptr;
+   size_t n_ = 0;
+   unsigned pending_ = 0;
+   size_t generation_ = 0;
+   bool stop_ = false;
+};
+
+}
+
+#endif
@@ -0,0 +1,195 @@
+//
+// Host-to-device, device-to-host, device-to-device and map/unmap bandwidth sweep over every OpenCL device.
+//
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+#include "bench_stats.hpp"
+#include "cl_raii.hpp"
+#include "device_registry.hpp"
+#include "host_memory.hpp"
+
+enum Operation { H2D, D2H, D2D, MAP, NUM_OF_OPERATIONS };
+const char *operation_names[NUM_OF_OPERATIONS] = {"H2D", "D2H", "D2D", "map"};
+
+// Device time of a finished command in nanoseconds
+double event_ns(cl_event event) {
+   cl_ulong start = 0, end = 0;
+   clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+   clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+   return static_cast<double>(end - start);
+}
+
+// One transfer of size bytes; map is the map plus the unmap of a whole region
+cl_int time_operation(Operation operation, cl_command_queue queue, cl_mem source, cl_mem target, void *host,
+                      size_t size, double *ns) {
+   cl_event events[2] = {nullptr, nullptr};
+   cl_int err = CL_SUCCESS;
+   switch (operation) {
+      case H2D:
+         err = clEnqueueWriteBuffer(queue, source, CL_FALSE, 0, size, host, 0, nullptr, &events[0]);
+         break;
+      case D2H:
+         err = clEnqueueReadBuffer(queue, source, CL_FALSE, 0, size, host, 0, nullptr, &events[0]);
+         break;
+      case D2D:
+         err = clEnqueueCopyBuffer(queue, source, target, 0, 0, size, 0, nullptr, &events[0]);
+         break;
+      default: {
+         void *mapped = clEnqueueMapBuffer(queue, source, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, size,
+                                           0, nullptr, &events[0], &err);
+         if (err == CL_SUCCESS)
+            err = clEnqueueUnmapMemObject(queue, source, mapped, 0, nullptr, &events[1]);
+      }
+   }
+   if (err == CL_SUCCESS)
+      err = clFinish(queue);
+   *ns = 0;
+   for (cl_event event : events) {
+      if (event == nullptr)
+         continue;
+      if (err == CL_SUCCESS)
+         *ns += event_ns(event);
+      clReleaseEvent(event);
+   }
+   return err;
+}
+
+// Sweep one device from min_bytes up to half its allocation limit (or max_bytes), factor apart
+int sweep_device(const cldevices::Entry &entry, size_t min_bytes, size_t max_bytes, double factor, int repeats,
+                 hostmem::Policy host_policy) {
+   cl_ulong max_alloc = 0, global_mem = 0;
+   clGetDeviceInfo(entry.device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, nullptr);
+   clGetDeviceInfo(entry.device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, nullptr);
+   // two device buffers for D2D, and the host side has to be allocated as well
+   size_t largest = static_cast<size_t>(std::min<cl_ulong>(max_alloc, global_mem / 4));
+   if (max_bytes)
+      largest = std::min(largest, max_bytes);
+   min_bytes = std::min(min_bytes, largest);
+   std::cout << "Device " << entry.label() << ": " << min_bytes << " to " << largest << " bytes, "
+             << (host_policy == hostmem::Policy::pinned ? "pinned" : "pageable") << " host memory" << std::endl;
+
+   cl_int err;
+   clwrap::Context context = clwrap::create_context(entry.device, &err);
+   clwrap::Queue queue;
+   clwrap::Buffer source, target;
+   if (err == CL_SUCCESS)
+      queue = clwrap::create_queue(context.get(), entry.device, CL_QUEUE_PROFILING_ENABLE, &err);
+   if (err == CL_SUCCESS)
+      source = clwrap::create_buffer(context.get(), CL_MEM_READ_WRITE, largest, nullptr, &err);
+   if (err == CL_SUCCESS)
+      target = clwrap::create_buffer(context.get(), CL_MEM_READ_WRITE, largest, nullptr, &err);
+   // pinned memory is owned by the context, pageable memory by the process
+   std::unique_ptr<hostmem::PinnedBuffer> pinned;
+   std::unique_ptr<void, void (*)(void *)> pageable(nullptr, hostmem::aligned_free);
+   void *host = nullptr;
+   if (err == CL_SUCCESS && host_policy == hostmem::Policy::pinned) {
+      pinned.reset(new hostmem::PinnedBuffer(context.get(), queue.get(), largest, &err));
+      host = pinned->data();
+   } else if (err == CL_SUCCESS) {
+      pageable.reset(hostmem::aligned_malloc(largest));
+      host = pageable.get();
+      if (host == nullptr)
+         err = CL_OUT_OF_HOST_MEMORY;
+   }
+   if (err != CL_SUCCESS) {
+      std::cout << "Setting up " << entry.label() << " failed with error " << err << std::endl;
+      return -1;
+   }
+   memset(host, 1, largest);
+
+   std::streamsize precision = std::cout.precision();
+   std::cout << std::setw(14) << "bytes";
+   for (const char *name : operation_names)
+      std::cout << std::setw(11) << std::string(name) + " us" << std::setw(9) << "GB/s";
+   std::cout << std::endl;
+   int status = 0;
+   for (double bytes = static_cast<double>(min_bytes); ; bytes *= factor) {
+      const size_t size = std::min(static_cast<size_t>(bytes), largest);
+      std::cout << std::setw(14) << size << std::fixed;
+      for (int operation = 0; operation < NUM_OF_OPERATIONS; ++operation) {
+         // one untimed transfer first, so the samples exclude first-use costs
+         std::vector<double> samples;
+         for (int repeat = 0; repeat <= repeats && err == CL_SUCCESS; ++repeat) {
+            double ns;
+            err = time_operation(static_cast<Operation>(operation), queue.get(), source.get(), target.get(), host,
+                                 size, &ns);
+            if (repeat > 0)
+               samples.push_back(ns);
+         }
+         if (err != CL_SUCCESS) {
+            std::cout << std::setw(11) << "error" << std::setw(9) << "-";
+            status = -1;
+            err = CL_SUCCESS;
+            continue;
+         }
+         // the median time shows latency at small sizes, GB/s (bytes moved / time) at large ones
+         benchstats::Summary summary = benchstats::summarize(samples);
+         std::cout << std::setprecision(1) << std::setw(11) << summary.median / 1e3 << std::setprecision(2)
+                   << std::setw(9) << (summary.median > 0 ? size / summary.median : 0);
+      }
+      std::cout.unsetf(std::ios::fixed);
+      std::cout.precision(precision);
+      std::cout << std::endl;
+      if (size >= largest)
+         break;
+   }
+   return status;
+}
+
+int main(int argc, char *argv[]) {
+   // --min-bytes B / --max-bytes B: transfer sizes at both ends of the sweep, 0 = device limit
+   // --factor F: ratio between consecutive sizes; --repeats R: timed transfers per operation and size
+   // --host-memory pageable|pinned: host side of H2D and D2H; --devices LIST: as in vec_add
+   size_t min_bytes = 4, max_bytes = 256 << 20;
+   double factor = 4;
+   int repeats = 20;
+   std::string host_memory_option = "pageable";
+   std::string device_pattern = "all";
+   for (int arg = 1; arg < argc; ++arg) {
+      std::string option(argv[arg]);
+      if (option == "--min-bytes" && arg + 1 < argc) {
+         min_bytes = std::max<size_t>(1, strtoull(argv[++arg], nullptr, 10));
+      } else if (option == "--max-bytes" && arg + 1 < argc) {
+         max_bytes = strtoull(argv[++arg], nullptr, 10);
+      } else if (option == "--factor" && arg + 1 < argc) {
+         factor = std::max(1.1, atof(argv[++arg]));
+      } else if (option == "--repeats" && arg + 1 < argc) {
+         repeats = std::max(1, atoi(argv[++arg]));
+      } else if (option == "--host-memory" && arg + 1 < argc) {
+         host_memory_option = argv[++arg];
+      } else if (option == "--devices" && arg + 1 < argc) {
+         device_pattern = argv[++arg];
+      } else {
+         std::cout << "Unknown option " << option << std::endl;
+         std::cout << "Usage: " << argv[0] << " [--min-bytes B] [--max-bytes B] [--factor F] [--repeats R]"
+                   << " [--host-memory pageable|pinned] [--devices LIST]" << std::endl;
+         return -1;
+      }
+   }
+
+   cldevices::Registry registry;
+   if (registry.list().empty()) {
+      std::cout << "Cannot get platform" << std::endl;
+      return -1;
+   }
+   std::vector<cldevices::Entry> selected = registry.select(device_pattern);
+   if (selected.empty()) {
+      std::cout << "No device matches --devices " << device_pattern << "; available devices:" << std::endl;
+      registry.print();
+      return -1;
+   }
+
+   int status = 0;
+   for (const cldevices::Entry &entry : selected)
+      if (sweep_device(entry, min_bytes, max_bytes, factor, repeats, hostmem::parse_policy(host_memory_option)) != 0)
+         status = -1;
+   return status;
+}
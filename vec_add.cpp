@@ -5,13 +5,40 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
 #include <vector>
 #include <iostream>
 #include <cmath>
 #include <string>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <complex>
+#include <sstream>
+#include <map>
 #include <CL/opencl.h>
 #include "cxxtimer.hpp"
+#include "cl_profile.hpp"
+#include "program_cache.hpp"
+#include "bench_stats.hpp"
+#include "host_memory.hpp"
+#include "stream_pipeline.hpp"
+#include "hetero.hpp"
+#include "chunk_scheduler.hpp"
+#include "work_group_tuner.hpp"
+#include "kernel_gen.hpp"
+#include "vec_kernel.hpp"
+#include "fused_expr.hpp"
+#include "reduction.hpp"
+#include "host_verify.hpp"
+#include "input_gen.hpp"
+#include "native_backend.hpp"
+#include "bench_report.hpp"
+#include "regression_gate.hpp"
+#include "device_registry.hpp"
+#include "cl_raii.hpp"
+#include "buffer_arena.hpp"
 const char *getErrorString(cl_int error)
 {
    switch(error){
@@ -89,38 +116,699 @@ const char *getErrorString(cl_int error)
    }
 }
 
-// OpenCL kernel. Each work item takes care of one element of c
-
-const char *kernelSource =                                       "\n" \
-// "#pragma OPENCL EXTENSION cl_khr_fp64 : enable                    \n" 
-"__kernel void vecAdd(  __global float *a,                       \n" \
-"                       __global float *b,                       \n" \
-"                       __global float *c,                       \n" \
-"                       const unsigned int n)                    \n" \
-"{                                                               \n" \
-"    //Get our global thread ID                                  \n" \
-"    int id = get_global_id(0);                                  \n" \
-"                                                                \n" \
-"    //Make sure we do not go out of bounds                      \n" \
-"    if (id < n){                                                 \n" \
-"        c[id] = a[id] + b[id];                                  \n" \
-"    }                                                           \n" \
-"}                                                               \n" \
-                                                                "\n" ;
-
-struct{
-   cl_device_type device_type;
-   std::string device_type_name;
-} platform_device_pair[]={
-        {CL_DEVICE_TYPE_CPU, "Intel(R) CPU Runtime for OpenCL(TM) Applications"},
-        {CL_DEVICE_TYPE_GPU, "Intel(R) OpenCL HD Graphics"},
-        {CL_DEVICE_TYPE_GPU, "NVIDIA CUDA"},
-};
+// Device time of the fastest launch of a vecAdd variant over the whole problem, 0 if it cannot run
+cl_ulong time_variant(cl_context context, cl_device_id device, cl_command_queue queue,
+                      clcache::ProgramCache &program_cache, const clkernels::Variant &variant,
+                      cl_mem d_a, cl_mem d_b, cl_mem d_c, unsigned int n) {
+   cl_int err;
+   clwrap::Program program(program_cache.build(context, device, variant.source.c_str(), "", &err));
+   if (!program)
+      return 0;
+   clwrap::Kernel kernel = clwrap::create_kernel(program.get(), variant.name.c_str(), &err);
+   if (!kernel)
+      return 0;
+   err = clSetKernelArg(kernel.get(), 0, sizeof(cl_mem), &d_a);
+   err |= clSetKernelArg(kernel.get(), 1, sizeof(cl_mem), &d_b);
+   err |= clSetKernelArg(kernel.get(), 2, sizeof(cl_mem), &d_c);
+   err |= clSetKernelArg(kernel.get(), 3, sizeof(unsigned int), &n);
+   if (err != CL_SUCCESS)
+      return 0;
+   return cltune::Tuner::fastest_launch(queue, [&](cl_command_queue q, cl_event *event) {
+      size_t global = variant.global_size(n, 0);
+      return clEnqueueNDRangeKernel(q, kernel.get(), 1, nullptr, &global, nullptr, 0, nullptr, event);
+   });
+}
+
+// Context, queue and vecAdd kernel on every selected device
+std::vector<clhetero::Worker> create_workers(const std::vector<cl_device_id> &devices,
+                                             clcache::ProgramCache &program_cache) {
+   cl_int err;
+   std::vector<clhetero::Worker> workers;
+   for (cl_device_id device : devices) {
+      clhetero::Worker worker;
+      worker.device = device;
+      worker.name = clcache::device_string(device, CL_DEVICE_NAME);
+      worker.variant = clkernels::vector_add(clkernels::device_width(device));
+      worker.context = clwrap::create_context(device, &err);
+      if (err == CL_SUCCESS)
+         worker.queue = clwrap::create_queue(worker.context.get(), device, 0, &err);
+      if (err == CL_SUCCESS)
+         worker.program = clwrap::Program(
+                 program_cache.build(worker.context.get(), device, worker.variant.source.c_str(), "", &err));
+      if (err == CL_SUCCESS)
+         worker.kernel = clwrap::create_kernel(worker.program.get(), worker.variant.name.c_str(), &err);
+      if (err != CL_SUCCESS) {
+         std::cout << "Skipping " << worker.name << ": " << getErrorString(err) << std::endl;
+         continue;
+      }
+      workers.push_back(std::move(worker));
+   }
+   return workers;
+}
+
+// Split one vector addition over every selected device and run all of them at once
+int run_heterogeneous(const std::vector<cl_device_id> &devices, unsigned int n,
+                      const float *h_a, const float *h_b, float *h_c, size_t localSize,
+                      clcache::ProgramCache &program_cache, int warmup, int iterations,
+                      benchreport::Report *report) {
+   cl_int err;
+   std::vector<clhetero::Worker> workers = create_workers(devices, program_cache);
+   if (workers.empty()) {
+      std::cout << "Cannot get device" << std::endl;
+      return -1;
+   }
+
+   // Size every device's share from its throughput on a 1M element probe
+   clhetero::probe(workers, h_a, h_b, h_c, std::min<size_t>(n, 1 << 20), localSize);
+   if (!clhetero::partition(workers, n, 4096)) {
+      std::cout << "No device could run the probe" << std::endl;
+      return -1;
+   }
+   for (auto &worker : workers) {
+      err = clhetero::allocate(worker, worker.count);
+      if (err != CL_SUCCESS) {
+         std::cout << "Create buffer failed on " << worker.name << ": " << getErrorString(err) << std::endl;
+         return -1;
+      }
+   }
+
+   std::vector<double> total_ms;
+   for (int run = 0; run < warmup + iterations; ++run) {
+      auto run_begin = std::chrono::steady_clock::now();
+      err = clhetero::run_concurrent(workers, h_a, h_b, h_c, localSize);
+      if (err != CL_SUCCESS) {
+         std::cout << "Heterogeneous run failed: " << getErrorString(err) << std::endl;
+         return -1;
+      }
+      if (run >= warmup)
+         total_ms.push_back(std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - run_begin).count());
+   }
+
+   for (auto &worker : workers)
+      std::cout << " " << worker.name << ": elements [" << worker.offset << ", " << worker.offset + worker.count
+                << "), probe " << worker.throughput / 1e3 << " M elements/s, last run " << worker.ms << " ms" << std::endl;
+   float sum = 0;
+   for (unsigned int i = 0; i < n; i++)
+      sum += h_c[i];
+   std::cout << "Result on " << workers.size() << " devices: " << sum << std::endl;
+   benchstats::Summary summary = benchstats::summarize(total_ms);
+   std::cout << "Heterogeneous vector addition took " << summary.median << " milliseconds (median of "
+             << summary.count << ")" << std::endl;
+   if (report != nullptr) {
+      benchreport::Record &record = report->add(benchreport::host_device(
+              "Heterogeneous (" + std::to_string(workers.size()) + " devices)", "MULTI"));
+      record.set("mode", "hetero");
+      record.set("n", std::to_string(n));
+      record.set("warmup", std::to_string(warmup));
+      record.set("local_size", std::to_string(localSize));
+      // the partition comes from this run's probe, so it is printed above rather than made part of the config
+      record.add("end-to-end", total_ms);
+   }
+   return 0;
+}
+
+// All devices and host_threads native threads pull guided chunks of at most max_chunk elements
+int run_dynamic_schedule(const std::vector<cl_device_id> &devices, unsigned int n,
+                         const float *h_a, const float *h_b, float *h_c, size_t localSize,
+                         clcache::ProgramCache &program_cache, int host_threads, size_t max_chunk,
+                         int warmup, int iterations, benchreport::Report *report) {
+   std::vector<clhetero::Worker> workers = create_workers(devices, program_cache);
+   if (workers.empty() && host_threads == 0) {
+      std::cout << "Cannot get device" << std::endl;
+      return -1;
+   }
+   // Each device keeps one set of chunk buffers for the whole run
+   for (auto &worker : workers)
+      max_chunk = std::min(max_chunk, clstream::max_chunk_elements(worker.device));
+   for (auto &worker : workers) {
+      cl_int err = clhetero::allocate(worker, max_chunk);
+      if (err != CL_SUCCESS) {
+         std::cout << "Create buffer failed on " << worker.name << ": " << getErrorString(err) << std::endl;
+         return -1;
+      }
+   }
+
+   const size_t min_chunk = std::min<size_t>(max_chunk, 1 << 16);
+   std::vector<double> total_ms;
+   std::vector<clsched::Report> reports;
+   for (int run = 0; run < warmup + iterations; ++run) {
+      auto run_begin = std::chrono::steady_clock::now();
+      reports = clsched::run_dynamic(workers, host_threads, h_a, h_b, h_c, n, min_chunk, max_chunk, localSize);
+      // the host finished a failed device's chunks, so the result is right but the timing is not
+      cl_int err = clsched::first_error(reports);
+      if (err != CL_SUCCESS) {
+         clsched::print_reports(reports);
+         std::cout << "Dynamically scheduled run failed: " << getErrorString(err) << std::endl;
+         return -1;
+      }
+      if (run >= warmup)
+         total_ms.push_back(std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - run_begin).count());
+   }
+
+   clsched::print_reports(reports);
+   float sum = 0;
+   for (unsigned int i = 0; i < n; i++)
+      sum += h_c[i];
+   std::cout << "Result on " << reports.size() << " workers: " << sum << std::endl;
+   benchstats::Summary summary = benchstats::summarize(total_ms);
+   std::cout << "Dynamically scheduled vector addition took " << summary.median << " milliseconds (median of "
+             << summary.count << ")" << std::endl;
+   if (report != nullptr) {
+      benchreport::Record &record = report->add(benchreport::host_device(
+              "Dynamic schedule (" + std::to_string(reports.size()) + " workers)", "MULTI"));
+      record.set("mode", "dynamic");
+      record.set("n", std::to_string(n));
+      record.set("warmup", std::to_string(warmup));
+      record.set("local_size", std::to_string(localSize));
+      record.set("host_threads", std::to_string(host_threads));
+      record.set("max_chunk", std::to_string(max_chunk));
+      record.add("end-to-end", total_ms);
+   }
+   return 0;
+}
+
+// vecAdd over element type T on one device: median kernel time and bandwidth, checked against the host
+template <typename T>
+int run_element_type(cl_device_id device, unsigned int n, clcache::ProgramCache &program_cache,
+                     int warmup, int iterations) {
+   typedef clkernels::VecKernel<T> Traits;
+   typedef typename Traits::host_type host_type;
+   if (!clkernels::supported<T>(device)) {
+      std::cout << "  " << Traits::label() << ": skipped, device lacks " << Traits::extension() << std::endl;
+      return 0;
+   }
+   // small integers, so every type (half included) adds them exactly
+   const size_t bytes = n * sizeof(host_type);
+   std::vector<host_type> h_a(n), h_b(n), h_c(n);
+   for (unsigned int i = 0; i < n; ++i) {
+      h_a[i] = Traits::from_double(i % 512);
+      h_b[i] = Traits::from_double(i % 256);
+   }
+
+   clkernels::Variant variant = clkernels::typed_vector_add<T>();
+   cl_int err;
+   clwrap::Context context = clwrap::create_context(device, &err);
+   clwrap::Queue queue;
+   clwrap::Program program;
+   clwrap::Kernel kernel;
+   clwrap::Buffer d_a, d_b, d_c;
+   if (err == CL_SUCCESS)
+      queue = clwrap::create_queue(context.get(), device, CL_QUEUE_PROFILING_ENABLE, &err);
+   if (err == CL_SUCCESS)
+      program = clwrap::Program(program_cache.build(context.get(), device, variant.source.c_str(), "", &err));
+   if (err == CL_SUCCESS)
+      kernel = clwrap::create_kernel(program.get(), variant.name.c_str(), &err);
+   if (err == CL_SUCCESS)
+      d_a = clwrap::create_buffer(context.get(), CL_MEM_READ_ONLY, bytes, nullptr, &err);
+   if (err == CL_SUCCESS)
+      d_b = clwrap::create_buffer(context.get(), CL_MEM_READ_ONLY, bytes, nullptr, &err);
+   if (err == CL_SUCCESS)
+      d_c = clwrap::create_buffer(context.get(), CL_MEM_WRITE_ONLY, bytes, nullptr, &err);
+   if (err == CL_SUCCESS) {
+      cl_mem buffers[] = {d_a.get(), d_b.get(), d_c.get()};
+      err = clEnqueueWriteBuffer(queue.get(), buffers[0], CL_TRUE, 0, bytes, h_a.data(), 0, nullptr, nullptr);
+      err |= clEnqueueWriteBuffer(queue.get(), buffers[1], CL_TRUE, 0, bytes, h_b.data(), 0, nullptr, nullptr);
+      for (cl_uint arg = 0; arg < 3; ++arg)
+         err |= clSetKernelArg(kernel.get(), arg, sizeof(cl_mem), &buffers[arg]);
+      err |= clSetKernelArg(kernel.get(), 3, sizeof(unsigned int), &n);
+   }
+
+   std::vector<double> kernel_ms;
+   size_t global_size = variant.global_size(n, 0);
+   for (int run = 0; run < warmup + iterations && err == CL_SUCCESS; ++run) {
+      cl_event event = nullptr;
+      err = clEnqueueNDRangeKernel(queue.get(), kernel.get(), 1, nullptr, &global_size, nullptr, 0, nullptr, &event);
+      clwrap::Event kernel_event(event);
+      if (err == CL_SUCCESS)
+         err = clWaitForEvents(1, &event);
+      if (err == CL_SUCCESS && run >= warmup)
+         kernel_ms.push_back(clprofile::event_duration(event) / 1e6);
+   }
+   if (err == CL_SUCCESS)
+      err = clEnqueueReadBuffer(queue.get(), d_c.get(), CL_TRUE, 0, bytes, h_c.data(), 0, nullptr, nullptr);
+
+   if (err != CL_SUCCESS) {
+      std::cout << "  " << Traits::label() << ": failed, " << getErrorString(err) << std::endl;
+   } else {
+      size_t mismatches = 0;
+      for (unsigned int i = 0; i < n; ++i)
+         if (Traits::to_double(h_c[i]) != Traits::to_double(h_a[i]) + Traits::to_double(h_b[i]))
+            ++mismatches;
+      benchstats::Summary summary = benchstats::summarize(kernel_ms);
+      std::cout << "  " << Traits::label() << ": kernel " << summary.median << " ms (median of " << summary.count
+                << "), " << 3.0 * bytes / (summary.median * 1e6) << " GB/s, "
+                << (mismatches ? std::to_string(mismatches) + " wrong elements" : std::string("verified")) << std::endl;
+      if (mismatches)
+         err = CL_INVALID_VALUE;
+   }
+   return err == CL_SUCCESS ? 0 : -1;
+}
+
+// Run every element type in types ("float", "double", "half", "int", "complex") on every selected device
+int run_element_types(const std::vector<cl_device_id> &devices, const std::vector<std::string> &types,
+                      unsigned int n, clcache::ProgramCache &program_cache, int warmup, int iterations) {
+   int status = 0;
+   for (cl_device_id device : devices) {
+      std::cout << "Element types on " << clcache::device_string(device, CL_DEVICE_NAME) << std::endl;
+      for (const std::string &type : types) {
+         int result;
+         if (type == "float")
+            result = run_element_type<float>(device, n, program_cache, warmup, iterations);
+         else if (type == "double")
+            result = run_element_type<double>(device, n, program_cache, warmup, iterations);
+         else if (type == "half")
+            result = run_element_type<clkernels::Half>(device, n, program_cache, warmup, iterations);
+         else if (type == "int")
+            result = run_element_type<int>(device, n, program_cache, warmup, iterations);
+         else if (type == "complex")
+            result = run_element_type<std::complex<float>>(device, n, program_cache, warmup, iterations);
+         else {
+            std::cout << "  " << type << ": unknown element type" << std::endl;
+            result = -1;
+         }
+         if (result != 0)
+            status = result;
+      }
+   }
+   return status;
+}
+
+// e = (a + b) * s + x as three separate kernels with intermediates, then as one fused kernel
+int run_fused_chain(const std::vector<cl_device_id> &devices, unsigned int n, const float *h_a, const float *h_b,
+                    clcache::ProgramCache &program_cache, int warmup, int iterations) {
+   const float s = 0.5f;
+   int status = 0;
+   for (cl_device_id device : devices) {
+      const std::string name = clcache::device_string(device, CL_DEVICE_NAME);
+      cl_int err;
+      clwrap::Context context = clwrap::create_context(device, &err);
+      clwrap::Queue queue;
+      if (err == CL_SUCCESS)
+         queue = clwrap::create_queue(context.get(), device, 0, &err);
+      if (err != CL_SUCCESS) {
+         std::cout << "Skipping " << name << ": " << getErrorString(err) << std::endl;
+         continue;
+      }
+      // declared after the context and queue, so the engine's buffers and kernels go first
+      clexpr::Engine engine(context.get(), device, queue.get(), program_cache);
+      clexpr::Vector a = engine.vector(n, h_a), b = engine.vector(n, h_b), x = engine.vector(n, h_a);
+      clexpr::Vector c = engine.vector(n), d = engine.vector(n), e = engine.vector(n);
+      std::vector<float> unfused(n), fused(n);
+
+      // Each step is evaluated on its own: 3 kernels, 9 vectors of traffic per element
+      std::vector<double> unfused_ms, fused_ms;
+      for (int run = 0; run < warmup + iterations && engine.error() == CL_SUCCESS; ++run) {
+         auto begin = std::chrono::steady_clock::now();
+         c = a + b;
+         d = c * s;
+         e = d + x;
+         clFinish(queue.get());
+         if (run >= warmup)
+            unfused_ms.push_back(std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - begin).count());
+      }
+      err = engine.error();
+      if (err == CL_SUCCESS)
+         err = e.read(unfused.data());
+
+      // One generated kernel, no intermediates: 4 vectors of traffic per element
+      for (int run = 0; run < warmup + iterations && err == CL_SUCCESS && engine.error() == CL_SUCCESS; ++run) {
+         auto begin = std::chrono::steady_clock::now();
+         e = (a + b) * s + x;
+         clFinish(queue.get());
+         if (run >= warmup)
+            fused_ms.push_back(std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - begin).count());
+      }
+      if (err == CL_SUCCESS)
+         err = engine.error();
+      if (err == CL_SUCCESS)
+         err = e.read(fused.data());
+
+      if (err != CL_SUCCESS) {
+         std::cout << "Fused expression on " << name << " failed: " << getErrorString(err) << std::endl;
+         status = -1;
+      } else {
+         float max_difference = 0;
+         for (unsigned int i = 0; i < n; ++i)
+            max_difference = std::max(max_difference, std::fabs(unfused[i] - fused[i]));
+         benchstats::Summary unfused_summary = benchstats::summarize(unfused_ms);
+         benchstats::Summary fused_summary = benchstats::summarize(fused_ms);
+         std::cout << "e = (a + b) * s + x on " << name << ": unfused " << unfused_summary.median
+                   << " ms, fused " << fused_summary.median << " ms (medians of " << fused_summary.count
+                   << "), " << engine.kernels() << " kernels generated, max difference " << max_difference
+                   << std::endl;
+      }
+   }
+   return status;
+}
+
+// Median wall time of fn() over iterations runs after warmup
+template <typename Function>
+double median_ms(int warmup, int iterations, Function fn) {
+   std::vector<double> samples;
+   for (int run = 0; run < warmup + iterations; ++run) {
+      auto begin = std::chrono::steady_clock::now();
+      if (fn() != CL_SUCCESS)
+         return -1;
+      if (run >= warmup)
+         samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+   }
+   return benchstats::summarize(samples).median;
+}
+
+// Upload and download of one vector per device: pageable host memory, pinned staging, and map + memcpy
+int run_host_memory_modes(const std::vector<cl_device_id> &devices, size_t bytes, float *h_a, float *h_c,
+                          clwrap::Pools &pools, int warmup, int iterations) {
+   int status = 0;
+   for (cl_device_id device : devices) {
+      const std::string name = clcache::device_string(device, CL_DEVICE_NAME);
+      cl_int err;
+      clwrap::DevicePool *device_pool = pools.get(device, &err);
+      clwrap::Lease<cl_command_queue> queue_lease;
+      clwrap::Lease<cl_mem> buffer;
+      if (device_pool != nullptr)
+         queue_lease = device_pool->queue(0, &err);
+      if (err == CL_SUCCESS)
+         buffer = device_pool->buffer(CL_MEM_READ_WRITE, bytes, &err);
+      std::unique_ptr<hostmem::PinnedBuffer> pinned;
+      if (err == CL_SUCCESS)
+         pinned.reset(new hostmem::PinnedBuffer(device_pool->context(), queue_lease.get(), bytes, &err));
+      if (err != CL_SUCCESS) {
+         std::cout << "Skipping " << name << ": " << getErrorString(err) << std::endl;
+         status = -1;
+         continue;
+      }
+      cl_command_queue queue = queue_lease.get();
+      cl_mem d_x = buffer.get();
+      void *staging = pinned->data();
+      memcpy(staging, h_a, bytes);
+
+      auto mapped_copy = [&](cl_map_flags flags, bool upload) {
+         cl_int map_err;
+         void *mapped = clEnqueueMapBuffer(queue, d_x, CL_TRUE, flags, 0, bytes, 0, nullptr, nullptr, &map_err);
+         if (map_err != CL_SUCCESS)
+            return map_err;
+         if (upload)
+            memcpy(mapped, h_a, bytes);
+         else
+            memcpy(h_c, mapped, bytes);
+         map_err = clEnqueueUnmapMemObject(queue, d_x, mapped, 0, nullptr, nullptr);
+         return map_err == CL_SUCCESS ? clFinish(queue) : map_err;
+      };
+      // pageable and pinned differ only in the host pointer handed to the blocking write and read
+      auto write_from = [&](void *host) {
+         return [=]() { return clEnqueueWriteBuffer(queue, d_x, CL_TRUE, 0, bytes, host, 0, nullptr, nullptr); };
+      };
+      auto read_into = [&](void *host) {
+         return [=]() { return clEnqueueReadBuffer(queue, d_x, CL_TRUE, 0, bytes, host, 0, nullptr, nullptr); };
+      };
+      const char *modes[] = {"pageable", "pinned", "mapped"};
+      const double upload_ms[] = {
+              median_ms(warmup, iterations, write_from(h_a)),
+              median_ms(warmup, iterations, write_from(staging)),
+              median_ms(warmup, iterations, [&]() { return mapped_copy(CL_MAP_WRITE_INVALIDATE_REGION, true); })};
+      const double download_ms[] = {
+              median_ms(warmup, iterations, read_into(h_c)),
+              median_ms(warmup, iterations, read_into(staging)),
+              median_ms(warmup, iterations, [&]() { return mapped_copy(CL_MAP_READ, false); })};
+
+      // "ms GB/s" columns, or "error" when a mode failed
+      auto print_cells = [&](double ms, int width) {
+         if (ms < 0)
+            std::cout << std::setw(width) << "error" << std::setw(10) << "-";
+         else
+            std::cout << std::setw(width) << std::setprecision(3) << ms << std::setw(10) << std::setprecision(2)
+                      << (ms > 0 ? bytes / ms / 1e6 : 0);
+      };
+      std::streamsize precision = std::cout.precision();
+      std::cout << "Host memory modes on " << name << ", " << bytes << " bytes, median of " << iterations << std::endl;
+      std::cout << "  " << std::left << std::setw(10) << "mode" << std::right << std::setw(12) << "upload ms"
+                << std::setw(10) << "GB/s" << std::setw(14) << "download ms" << std::setw(10) << "GB/s" << std::endl;
+      for (int mode = 0; mode < 3; ++mode) {
+         std::cout << "  " << std::left << std::setw(10) << modes[mode] << std::right << std::fixed;
+         print_cells(upload_ms[mode], 12);
+         print_cells(download_ms[mode], 14);
+         std::cout << std::endl;
+         if (upload_ms[mode] < 0 || download_ms[mode] < 0)
+            status = -1;
+      }
+      std::cout.unsetf(std::ios::fixed);
+      std::cout.precision(precision);
+   }
+   return status;
+}
+
+// The native backend as one more device: same runs, checksum and reports as the OpenCL devices
+void run_native(hostnative::Backend &backend, unsigned int n, const float *h_a, const float *h_b, float *h_c,
+                int warmup, int iterations, bool benchmark, bool parallel_checksum, benchreport::Report *report) {
+   timer_start("Vector addition on " + backend.name(), 'm');
+   std::vector<double> total_ms;
+   for (int run = 0; run < warmup + iterations; ++run) {
+      auto run_begin = std::chrono::steady_clock::now();
+      backend.add(h_a, h_b, h_c, n);
+      if (run >= warmup)
+         total_ms.push_back(std::chrono::duration<double, std::milli>(
+                 std::chrono::steady_clock::now() - run_begin).count());
+   }
+
+   if (parallel_checksum) {
+      std::cout << "Result on " << backend.name() << ": " << backend.sum(h_c, n) << " (parallel sum)" << std::endl;
+   } else {
+      float sum = 0;
+      for (unsigned int i = 0; i < n; i++)
+         sum += h_c[i];
+      std::cout << "Result on " << backend.name() << ": " << sum << std::endl;
+   }
+   if (benchmark) {
+      // no transfers: the kernel is the whole run
+      std::cout << "Benchmark on " << backend.name() << ": " << iterations << " iterations after " << warmup
+                << " warm-up" << std::endl;
+      benchstats::print_header("ms");
+      benchstats::print_row("kernel", benchstats::summarize(total_ms));
+      benchstats::print_row("end-to-end", benchstats::summarize(total_ms));
+   }
+   if (report != nullptr) {
+      benchreport::Record &record = report->add(benchreport::host_device(backend.name()));
+      record.set("mode", "native");
+      record.set("n", std::to_string(n));
+      record.set("warmup", std::to_string(warmup));
+      record.set("threads", std::to_string(backend.pool().size()));
+      record.set("isa", hostsimd::isa());
+      record.add("kernel", total_ms);
+      record.add("end-to-end", total_ms);
+   }
+   timer_stop('m');
+}
 
 int main( int argc, char* argv[] ) {
    // Length of vectors
    unsigned int n = 10000000;
 
+   // --profile: per-phase breakdown from OpenCL profiling events
+   bool profile = false;
+   // --cache-dir DIR / --no-cache: where compiled program binaries are kept
+   std::string cache_dir = ".clcache";
+   // --iterations N / --warmup W: steady-state benchmark on the same context, queue and buffers
+   int iterations = 1, warmup = 0;
+   // --zero-copy auto|on|off: map CL_MEM_USE_HOST_PTR buffers instead of copying, auto on unified memory
+   std::string zero_copy_mode = "auto";
+   // --stream: chunked pipeline overlapping upload, compute and download
+   // --chunk N: elements per chunk, 0 tunes it per device; --stream-depth D: chunks in flight
+   bool stream = false;
+   size_t chunk_elements = 0;
+   int stream_depth = 3;
+   // --hetero: split the vectors across all devices and run them concurrently
+   bool hetero = false;
+   // --dynamic: devices (and --host-threads T native threads) pull guided chunks of at most --chunk elements
+   bool dynamic = false;
+   int host_threads = 0;
+   // --local-size N|auto: work-group size, 0 for a NULL local size, auto tunes it per device
+   // --tuning-file PATH: where tuned work-group sizes are kept
+   std::string local_size_option = "auto";
+   std::string tuning_file = "vec_add.tuning";
+   // --vector-width N|auto|tune: floatN variant of vecAdd, auto from the device's preferred/native float width
+   std::string vector_width_option = "auto";
+   // --coarsen off|K|auto|tune: grid-stride vecAdd with K vectors per work item, auto sizes the grid from
+   // CL_DEVICE_MAX_COMPUTE_UNITS; --layout strided|contiguous: how each work item walks its vectors
+   std::string coarsen_option = "off";
+   clkernels::Layout layout = clkernels::Layout::strided;
+   // --element-types LIST: comma separated float,double,half,int,complex vecAdd benchmark on every device
+   std::vector<std::string> element_types;
+   // --fused: compare e = (a + b) * s + x step by step against one generated fused kernel
+   bool fused = false;
+   // --checksum host|device|fused: sum c on the host after a full readback, with a device reduction kernel
+   // instead of the readback, or inside a vecAdd kernel that also reduces
+   std::string checksum_mode = "host";
+   // --verify [--verify-ulps U]: compare every element of c with a threaded SIMD host reference, U ulp tolerance
+   bool verify = false;
+   unsigned int verify_ulps = 0;
+   // --init serial|parallel|device: where a and b are generated; device skips the host loop and the upload
+   // --input ramp|constant|philox [--seed S]: what they hold; serial ramp is the original 1.0*i/n loop
+   std::string init_mode = "serial";
+   std::string input_name = "ramp";
+   uint32_t seed = 0;
+   // --native [--native-threads T]: also run the pinned thread pool + SIMD host backend as a device; it is
+   // used on its own when no OpenCL platform is found
+   bool native = false;
+   unsigned int native_threads = 0;
+   // --json PATH / --csv PATH: every timing sample with device, driver and run configuration, for later analysis
+   std::string json_path, csv_path;
+   // --baseline PATH [--regression-threshold PCT] [--regression-alpha A]: rerun and compare every sample with a
+   // --csv file of an earlier run, fail if a median got PCT% (default 5) slower with Mann-Whitney p < A (0.05)
+   std::string baseline_path;
+   benchgate::Options gate_options;
+   // --devices LIST: comma separated all|gpu|cpu|accelerator|N|P:D|name, vendor or platform substring;
+   // --list-devices: print every platform's devices with the indices --devices takes, then exit
+   std::string device_pattern = "all";
+   bool list_devices = false;
+   // --arena bump|free-list [--arena-bytes B]: carve the copy-path buffers out of one B byte buffer per device
+   // (default: room for a, b and c) with clCreateSubBuffer instead of allocating each of them
+   std::string arena_option;
+   size_t arena_bytes = 0;
+   // --host-memory pageable|pinned|compare: copy-path transfers from process memory or from a mapped
+   // CL_MEM_ALLOC_HOST_PTR staging buffer; compare times upload/download per device in both and with map + memcpy
+   std::string host_memory_option = "pageable";
+   for (int arg = 1; arg < argc; ++arg) {
+      std::string option(argv[arg]);
+      if (option == "--profile") {
+         profile = true;
+      } else if (option == "--cache-dir" && arg + 1 < argc) {
+         cache_dir = argv[++arg];
+      } else if (option == "--no-cache") {
+         cache_dir.clear();
+      } else if (option == "--iterations" && arg + 1 < argc) {
+         iterations = std::max(1, atoi(argv[++arg]));
+      } else if (option == "--warmup" && arg + 1 < argc) {
+         warmup = std::max(0, atoi(argv[++arg]));
+      } else if (option == "--zero-copy" && arg + 1 < argc) {
+         zero_copy_mode = argv[++arg];
+      } else if (option == "--hetero") {
+         hetero = true;
+      } else if (option == "--dynamic") {
+         dynamic = true;
+      } else if (option == "--host-threads" && arg + 1 < argc) {
+         host_threads = std::max(0, atoi(argv[++arg]));
+      } else if (option == "--local-size" && arg + 1 < argc) {
+         local_size_option = argv[++arg];
+      } else if (option == "--tuning-file" && arg + 1 < argc) {
+         tuning_file = argv[++arg];
+      } else if (option == "--vector-width" && arg + 1 < argc) {
+         vector_width_option = argv[++arg];
+      } else if (option == "--coarsen" && arg + 1 < argc) {
+         coarsen_option = argv[++arg];
+      } else if (option == "--layout" && arg + 1 < argc) {
+         layout = std::string(argv[++arg]) == "contiguous" ? clkernels::Layout::contiguous : clkernels::Layout::strided;
+      } else if (option == "--element-types" && arg + 1 < argc) {
+         std::istringstream list(argv[++arg]);
+         std::string type;
+         while (std::getline(list, type, ','))
+            element_types.push_back(type);
+      } else if (option == "--checksum" && arg + 1 < argc) {
+         checksum_mode = argv[++arg];
+      } else if (option == "--verify") {
+         verify = true;
+      } else if (option == "--verify-ulps" && arg + 1 < argc) {
+         verify = true;
+         verify_ulps = strtoul(argv[++arg], nullptr, 10);
+      } else if (option == "--init" && arg + 1 < argc) {
+         init_mode = argv[++arg];
+      } else if (option == "--input" && arg + 1 < argc) {
+         input_name = argv[++arg];
+      } else if (option == "--seed" && arg + 1 < argc) {
+         seed = strtoul(argv[++arg], nullptr, 10);
+      } else if (option == "--native") {
+         native = true;
+      } else if (option == "--native-threads" && arg + 1 < argc) {
+         native = true;
+         native_threads = strtoul(argv[++arg], nullptr, 10);
+      } else if (option == "--json" && arg + 1 < argc) {
+         json_path = argv[++arg];
+      } else if (option == "--csv" && arg + 1 < argc) {
+         csv_path = argv[++arg];
+      } else if (option == "--baseline" && arg + 1 < argc) {
+         baseline_path = argv[++arg];
+      } else if (option == "--regression-threshold" && arg + 1 < argc) {
+         gate_options.threshold = std::max(0.0, atof(argv[++arg]) / 100);
+      } else if (option == "--regression-alpha" && arg + 1 < argc) {
+         gate_options.alpha = atof(argv[++arg]);
+      } else if (option == "--devices" && arg + 1 < argc) {
+         device_pattern = argv[++arg];
+      } else if (option == "--arena" && arg + 1 < argc) {
+         arena_option = argv[++arg];
+      } else if (option == "--arena-bytes" && arg + 1 < argc) {
+         arena_bytes = strtoull(argv[++arg], nullptr, 10);
+      } else if (option == "--host-memory" && arg + 1 < argc) {
+         host_memory_option = argv[++arg];
+      } else if (option == "--list-devices") {
+         list_devices = true;
+      } else if (option == "--fused") {
+         fused = true;
+      } else if (option == "--stream") {
+         stream = true;
+      } else if (option == "--chunk" && arg + 1 < argc) {
+         chunk_elements = strtoull(argv[++arg], nullptr, 10);
+      } else if (option == "--stream-depth" && arg + 1 < argc) {
+         stream_depth = std::max(2, atoi(argv[++arg]));
+      } else {
+         std::cout << "Unknown option " << option << std::endl;
+         std::cout << "Usage: " << argv[0] << " [--devices LIST | --list-devices] [--profile] [--cache-dir DIR | --no-cache]"
+                   << " [--iterations N] [--warmup W] [--zero-copy auto|on|off]"
+                   << " [--stream [--chunk N] [--stream-depth D]] [--hetero]"
+                   << " [--dynamic [--host-threads T]] [--local-size N|auto] [--tuning-file PATH]"
+                   << " [--vector-width N|auto|tune] [--coarsen off|K|auto|tune [--layout strided|contiguous]]"
+                   << " [--element-types float,double,half,int,complex] [--fused]"
+                   << " [--checksum host|device|fused] [--verify [--verify-ulps U]]"
+                   << " [--init serial|parallel|device] [--input ramp|constant|philox] [--seed S]"
+                   << " [--native [--native-threads T]] [--json PATH] [--csv PATH]"
+                   << " [--baseline PATH [--regression-threshold PCT] [--regression-alpha A]]"
+                   << " [--arena bump|free-list [--arena-bytes B]] [--host-memory pageable|pinned|compare]" << std::endl;
+         return -1;
+      }
+   }
+   // Every platform's devices, however many there are and in whatever order the ICD loader reports them
+   cldevices::Registry registry;
+   if (list_devices) {
+      registry.print();
+      return 0;
+   }
+   bool benchmark = iterations > 1 || warmup > 0;
+   const hostmem::Policy host_policy = hostmem::parse_policy(host_memory_option);
+   // samples are kept whenever they are printed or reported
+   benchreport::Report report("vec_add");
+   const bool reporting = !json_path.empty() || !csv_path.empty() || !baseline_path.empty();
+   const bool collect = benchmark || reporting;
+   std::vector<benchreport::Record> baseline;
+   if (!baseline_path.empty() && !benchreport::read_csv(baseline_path, &baseline)) {
+      std::cout << "Cannot read baseline " << baseline_path
+                << ", expected a --csv file of one vec_add run" << std::endl;
+      return -1;
+   }
+   // a Mann-Whitney test on fewer samples can never reject, so the gate would always pass
+   if (!baseline_path.empty() && iterations < benchgate::min_samples(gate_options.alpha)) {
+      std::cout << "--baseline needs at least " << benchgate::min_samples(gate_options.alpha)
+                << " --iterations to detect a regression at alpha " << gate_options.alpha << std::endl;
+      return -1;
+   }
+   // writes the requested files, then returns the regression gate's verdict
+   auto write_report = [&]() {
+      if (!json_path.empty() && !report.write_json(json_path))
+         std::cout << "Cannot write " << json_path << std::endl;
+      if (!csv_path.empty() && !report.write_csv(csv_path))
+         std::cout << "Cannot write " << csv_path << std::endl;
+      if (baseline_path.empty())
+         return 0;
+      std::cout << "Comparing with baseline " << baseline_path << std::endl;
+      return benchgate::compare(baseline, report.records(), gate_options) ? -1 : 0;
+   };
+   std::unique_ptr<hostpool::ThreadPool> verify_pool(verify ? new hostpool::ThreadPool() : nullptr);
+   int verify_failures = 0;
+   std::unique_ptr<hostnative::Backend> native_backend(native ? new hostnative::Backend(native_threads) : nullptr);
+   clcache::ProgramCache program_cache(cache_dir);
+   cltune::Tuner tuner(tuning_file);
+
    // Host input vectors
    float *h_a;
    float *h_b;
@@ -131,182 +819,559 @@ int main( int argc, char* argv[] ) {
    size_t bytes = n * sizeof(float);
 
    std::cout << "Number of bytes in Giga: " << 3*static_cast<float>(bytes)/pow(10,9) << std::endl;
-   // Allocate memory for each vector on host
-   h_a = (float *) malloc(bytes);
-   h_b = (float *) malloc(bytes);
-   h_c = (float *) malloc(bytes);
+   // Allocate memory for each vector on host, page aligned so the zero-copy path can wrap it;
+   // the owners free it on every return
+   typedef std::unique_ptr<float, void (*)(void *)> HostVector;
+   HostVector a_memory((float *) hostmem::aligned_malloc(bytes), hostmem::aligned_free);
+   HostVector b_memory((float *) hostmem::aligned_malloc(bytes), hostmem::aligned_free);
+   HostVector c_memory((float *) hostmem::aligned_malloc(bytes), hostmem::aligned_free);
+   h_a = a_memory.get();
+   h_b = b_memory.get();
+   h_c = c_memory.get();
+   if (h_a == nullptr || h_b == nullptr || h_c == nullptr) {
+      std::cout << "Allocate host memory failed" << std::endl;
+      return -1;
+   }
+
+   // Bind to the selected devices; without a platform the native backend takes over, before inputs are set up
+   std::vector<cldevices::Entry> selected = registry.select(device_pattern);
+   const std::vector<cl_device_id> selected_ids = cldevices::device_ids(selected);
+   if (registry.list().empty()) {
+      std::cout << "Cannot get platform, running on the native host backend" << std::endl;
+      if (!native_backend)
+         native_backend.reset(new hostnative::Backend(native_threads));
+   } else if (selected.empty()) {
+      std::cout << "No device matches --devices " << device_pattern << "; available devices:" << std::endl;
+      registry.print();
+      return -1;
+   }
 
-   // Initialize vectors on host
+   // Initialize vectors on host; device generation only needs host copies for the paths that read them
    int i;
-   for (i = 0; i < n; i++) {
-      h_a[i] = 1.0*i/n;
-      h_b[i] = 1.0*i/n;
+   const clinit::Pattern input_pattern = clinit::parse_pattern(input_name);
+   const float input_start = input_pattern == clinit::Pattern::constant ? 0.5f : 0.0f;
+   const float input_step = input_pattern == clinit::Pattern::ramp ? 1.0f / n : 1.0f;
+   const bool device_init = init_mode == "device" && !stream && !hetero && !dynamic && !fused && !native_backend;
+   if (init_mode == "serial" && input_pattern == clinit::Pattern::ramp) {
+      for (i = 0; i < n; i++) {
+         h_a[i] = 1.0*i/n;
+         h_b[i] = 1.0*i/n;
+      }
+   } else if (!device_init || verify) {
+      timer_start("Initialize inputs on host", 'm');
+      // the native backend's pinned pool first-touches the slices it will add later
+      std::unique_ptr<hostpool::ThreadPool> own_pool;
+      if (!native_backend || init_mode == "serial")
+         own_pool.reset(new hostpool::ThreadPool(init_mode == "serial" ? 1 : 0));
+      hostpool::ThreadPool &init_pool = own_pool ? *own_pool : native_backend->pool();
+      clinit::fill_host(init_pool, h_a, n, input_pattern, input_start, input_step, seed, 0);
+      clinit::fill_host(init_pool, h_b, n, input_pattern, input_start, input_step, seed, 1);
+      timer_stop('m');
    }
 
 
 
-   cl_context context;               // context
-   cl_command_queue queue;           // command queue
-   cl_program program;               // program
-   cl_kernel kernel;                 // kernel
    cl_int err;
-   // Bind to platform
-   cl_uint num_pltfs, num_devs, num_entries = 3;
-   std::vector<cl_platform_id> platforms(num_entries);        // OpenCL platform
-   std::vector<cl_device_id> device_ids(num_entries);           // device ID
-   err = clGetPlatformIDs(num_entries, &platforms[0], &num_pltfs);
-   if (err != CL_SUCCESS) {
-      std::cout << "Cannot get platform" << std::endl;
-      return -1;
-   }
+   // Contexts, queues and buffers per device, reused by every job on that device
+   clwrap::Pools pools;
+   // Suballocation arenas per device, for --arena
+   std::map<cl_device_id, std::unique_ptr<clarena::Arena>> arenas;
 
-   for (i = 0; i < num_pltfs; ++i) {
-// Get the length for the i-th platform name
-      size_t platform_name_length = 0;
-      err = clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME, 0, nullptr, &platform_name_length);
+   for (const cldevices::Entry &entry : selected)
+      std::cout << " [" << entry.index << "] " << entry.label() << " on " << entry.platform_name << std::endl;
 
-// Get the name itself for the i-th platform
-      char *platform_name = new char[platform_name_length];
-      err = clGetPlatformInfo(platforms[i], CL_PLATFORM_NAME, platform_name_length, platform_name, nullptr);
+   if (!element_types.empty()) {
+      int status = run_element_types(selected_ids, element_types, n, program_cache, warmup, iterations);
+      program_cache.print_stats();
+      return status;
+   }
 
-// Output platform name
-      std::cout << " [" << i << "] " << platform_name << std::endl;
-      delete[] platform_name;
+   if (host_memory_option == "compare") {
+      int status = run_host_memory_modes(selected_ids, bytes, h_a, h_c, pools, warmup, std::max(iterations, 10));
+      program_cache.print_stats();
+      return status;
    }
 
-   for(cl_uint i_pltf=0; i_pltf<num_pltfs; i_pltf++){
-      timer_start("Vector addition on " + platform_device_pair[i_pltf].device_type_name, 'm');
-      // Get ID for the device
-      err = clGetDeviceIDs(platforms[i_pltf], platform_device_pair[i_pltf].device_type, num_entries, &device_ids[0], &num_devs);
-      if (err != CL_SUCCESS) {
-         std::cout << "Cannot get device" << std::endl;
-         switch (err) {
-            case CL_INVALID_PLATFORM: std::cout << "CL_INVALID_PLATFORM" << std::endl;
-            case CL_INVALID_DEVICE_TYPE: std::cout << "CL_INVALID_DEVICE_TYPE" << std::endl;
-            case CL_INVALID_VALUE: std::cout << "CL_INVALID_VALUE" << std::endl;
-            case CL_DEVICE_NOT_FOUND: std::cout << "CL_DEVICE_NOT_FOUND" << std::endl;
-         }
-         return -1;
+   if (fused) {
+      int status = run_fused_chain(selected_ids, n, h_a, h_b, program_cache, warmup, iterations);
+      program_cache.print_stats();
+      return status;
+   }
+
+   if (hetero || dynamic) {
+      timer_start(hetero ? "Heterogeneous vector addition" : "Dynamically scheduled vector addition", 'm');
+      benchreport::Report *target = reporting ? &report : nullptr;
+      // devices differ in their best work-group size, so without --local-size each driver picks its own
+      const size_t shared_local_size =
+              local_size_option == "auto" ? 0 : strtoull(local_size_option.c_str(), nullptr, 10);
+      int status = hetero ? run_heterogeneous(selected_ids, n, h_a, h_b, h_c, shared_local_size, program_cache,
+                                              warmup, iterations, target)
+                          : run_dynamic_schedule(selected_ids, n, h_a, h_b, h_c, shared_local_size, program_cache,
+                                                 host_threads, chunk_elements ? chunk_elements : 1 << 22, warmup,
+                                                 iterations, target);
+      timer_stop('m');
+      if (write_report() != 0)
+         status = -1;
+      if (verify && status == 0) {
+         hostverify::Report report = hostverify::verify_add(*verify_pool, h_a, h_b, h_c, n, verify_ulps);
+         hostverify::print_report(report, verify_ulps);
+         if (report.mismatches)
+            status = -1;
       }
+      program_cache.print_stats();
+      return status;
+   }
 
-      cl_device_id device_id = device_ids[0];
+   for (const cldevices::Entry &entry : selected) {
+      const std::string device_name = entry.label();
+      timer_start("Vector addition on " + device_name, 'm');
+      cl_device_id device_id = entry.device;
+      clprofile::Profile run_profile;
 
-      // Create a context
-      context = clCreateContext(nullptr, 1, &device_id, nullptr, nullptr, &err);
-      if (err != CL_SUCCESS) {
+      // Zero-copy only pays off when the device shares physical memory with the host
+      cl_bool unified_memory = CL_FALSE;
+      cl_uint base_addr_align_bits = 0;
+      clGetDeviceInfo(device_id, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified_memory), &unified_memory, nullptr);
+      clGetDeviceInfo(device_id, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(base_addr_align_bits), &base_addr_align_bits, nullptr);
+      bool zero_copy = !stream && (zero_copy_mode == "on" || (zero_copy_mode == "auto" && unified_memory));
+      if (zero_copy && base_addr_align_bits / 8 > hostmem::page_alignment) {
+         std::cout << "Host vectors are not aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN, copying instead" << std::endl;
+         zero_copy = false;
+      }
+      if (zero_copy)
+         std::cout << "Zero-copy buffers on " << device_name << std::endl;
+
+      // Get the device's context and a command queue from its pool; only the first job on a device creates them
+      if (profile) timer_start("Create context", 'u');
+      clwrap::DevicePool *device_pool = pools.get(device_id, &err);
+      if (device_pool == nullptr) {
          std::cout << "Create context failed" << std::endl;
          return -1;
       }
-      // Create a command queue
-      queue = clCreateCommandQueue(context, device_id, 0, &err);
+      cl_context context = device_pool->context();
+      clwrap::Lease<cl_command_queue> queue_lease =
+              device_pool->queue(profile || collect ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
       if (err != CL_SUCCESS) {
          std::cout << "Create command queue failed" << std::endl;
          return -1;
       }
+      cl_command_queue queue = queue_lease.get();
+      if (profile) run_profile.add_host("context", timer_stop('u'));
 
+      // Create the input and output arrays in device memory for our calculation
+      if (profile) timer_start("Create buffers", 'u');
+      // The copy path fills the inputs with clEnqueueWriteBuffer, so they are not initialized from h_a/h_b here;
+      // its buffers come from the pool and may be larger than bytes
+      clwrap::Lease<cl_mem> buffers[3];
+      cl_int buffer_err = CL_SUCCESS;
+      if (zero_copy) {
+         float *host[3] = {h_a, h_b, h_c};
+         for (int k = 0; k < 3; ++k) {
+            const cl_mem_flags access = k < 2 ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY;
+            buffers[k] = clwrap::Lease<cl_mem>(
+                    clwrap::create_buffer(context, access | CL_MEM_USE_HOST_PTR, bytes, host[k], &buffer_err));
+         }
+      } else if (!stream) {
+         clarena::Arena *arena = nullptr;
+         if (!arena_option.empty()) {
+            std::unique_ptr<clarena::Arena> &slot = arenas[device_id];
+            if (!slot) {
+               // three vectors, each padded to the worst-case alignment
+               const size_t capacity = arena_bytes ? arena_bytes : 3 * (bytes + 4096);
+               slot.reset(new clarena::Arena(context, device_id, capacity, clarena::parse_strategy(arena_option), &err));
+               if (err != CL_SUCCESS)
+                  std::cout << "Create arena failed: " << getErrorString(err) << ", using separate buffers" << std::endl;
+            }
+            if (slot->stats().capacity > 0)
+               arena = slot.get();
+         }
+         for (int k = 0; k < 3; ++k) {
+            const cl_mem_flags access = k < 2 ? CL_MEM_READ_ONLY : CL_MEM_WRITE_ONLY;
+            buffers[k] = arena ? arena->allocate(access, bytes, &buffer_err)
+                               : device_pool->buffer(access, bytes, &buffer_err);
+         }
+      }
       // Device input buffers
-      cl_mem d_a;
-      cl_mem d_b;
+      cl_mem d_a = buffers[0].get();
+      cl_mem d_b = buffers[1].get();
       // Device output buffer
-      cl_mem d_c;
-
-      // Create the input and output arrays in device memory for our calculation
-      d_a = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, h_a, nullptr);
-      d_b = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes, h_b, nullptr);
-      d_c = clCreateBuffer(context, CL_MEM_WRITE_ONLY, bytes, nullptr, nullptr);
-      if (d_a == nullptr || d_b == nullptr || d_c == nullptr) {
+      cl_mem d_c = buffers[2].get();
+      if (!stream && (d_a == nullptr || d_b == nullptr || d_c == nullptr)) {
          std::cout << "Create buffer failed" << std::endl;
          return -1;
       }
 
-      size_t globalSize, localSize;
-      // Number of work items in each local work group
-      localSize = 8;
+      // Pinned staging for the copy path: a and b are copied in once, then every run transfers page-locked memory
+      const bool pinned = host_policy == hostmem::Policy::pinned && !zero_copy && !stream;
+      std::unique_ptr<hostmem::PinnedBuffer> staging[3];
+      float *src_a = h_a, *src_b = h_b, *dst_c = h_c;
+      if (pinned) {
+         for (auto &buffer : staging) {
+            buffer.reset(new hostmem::PinnedBuffer(context, queue, bytes, &err));
+            if (err != CL_SUCCESS) {
+               std::cout << "Create pinned staging failed: " << getErrorString(err) << std::endl;
+               return -1;
+            }
+         }
+         src_a = static_cast<float *>(staging[0]->data());
+         src_b = static_cast<float *>(staging[1]->data());
+         dst_c = static_cast<float *>(staging[2]->data());
+         if (!device_init) {
+            memcpy(src_a, h_a, bytes);
+            memcpy(src_b, h_b, bytes);
+         }
+      }
+      if (profile) run_profile.add_host("buffers", timer_stop('u'));
 
-      // Number of total work items - localSize must be devisor
-      globalSize = static_cast<size_t>(ceil(n / (float) localSize) * localSize);
+      size_t globalSize, localSize;
 
-      // Write our data set into the input array in device memory
-      err = clEnqueueWriteBuffer(queue, d_a, CL_TRUE, 0,
-                                 bytes, h_a, 0, nullptr, nullptr);
-      err |= clEnqueueWriteBuffer(queue, d_b, CL_TRUE, 0,
-                                  bytes, h_b, 0, nullptr, nullptr);
-      if (err != CL_SUCCESS) {
-         std::cout << "Enqueue Write Buffer failed" << std::endl;
-         return -1;
+      // Pick the kernel variant; tuning times every width on the real buffers, so streaming only reuses it
+      clkernels::Variant variant;
+      size_t width = clkernels::device_width(device_id);
+      if (vector_width_option == "tune" && !stream) {
+         clwrap::Lease<cl_command_queue> tune_queue = device_pool->queue(CL_QUEUE_PROFILING_ENABLE, &err);
+         if (err == CL_SUCCESS) {
+            std::cout << "Tuning vector width on " << device_name << std::endl;
+            width = tuner.choose(device_id, "vecAdd.width", n, {1, 2, 4, 8, 16}, [&](size_t candidate) {
+               return time_variant(context, device_id, tune_queue.get(), program_cache,
+                                   clkernels::vector_add(candidate), d_a, d_b, d_c, n);
+            });
+         }
+      } else if (vector_width_option == "tune") {
+         tuner.lookup(device_id, "vecAdd.width", n, &width);
+      } else if (vector_width_option != "auto") {
+         width = strtoul(vector_width_option.c_str(), nullptr, 10);
       }
+      variant = clkernels::vector_add(width);
 
-      // Create the compute program from the source buffer
-      program = clCreateProgramWithSource(context, 1, (const char **) &kernelSource, nullptr, &err);
-      if (program == nullptr) {
-         std::cout << "Create program failed" << std::endl;
-         return -1;
+      // Thread coarsening: the same grid-stride source serves every K, only the global size changes
+      if (coarsen_option != "off") {
+         size_t coarsening = clkernels::occupancy_coarsening(device_id, n, variant.width);
+         const std::string parameter = clkernels::vector_add(width, layout).key() + ".coarsening";
+         if (coarsen_option == "tune" && !stream) {
+            clwrap::Lease<cl_command_queue> tune_queue = device_pool->queue(CL_QUEUE_PROFILING_ENABLE, &err);
+            if (err == CL_SUCCESS) {
+               std::cout << "Tuning coarsening on " << device_name << std::endl;
+               coarsening = tuner.choose(device_id, parameter, n, {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024},
+                                         [&](size_t candidate) {
+                  return time_variant(context, device_id, tune_queue.get(), program_cache,
+                                      clkernels::vector_add(width, layout, candidate), d_a, d_b, d_c, n);
+               });
+            }
+         } else if (coarsen_option == "tune") {
+            tuner.lookup(device_id, parameter, n, &coarsening);
+         } else if (coarsen_option != "auto") {
+            coarsening = strtoull(coarsen_option.c_str(), nullptr, 10);
+         }
+         variant = clkernels::vector_add(width, layout, coarsening);
       }
-      // Build the program executable
-      clBuildProgram(program, 0, nullptr, nullptr, nullptr, nullptr);
-      if (err != CL_SUCCESS) {
-         std::cout << "Build program failed" << std::endl;
 
+      // Create the compute program from the program cache, or build it from the source buffer
+      if (profile) timer_start("Build program", 'u');
+      clwrap::Program program(program_cache.build(context, device_id, variant.source.c_str(), "", &err));
+      if (!program) {
+         std::cout << "Build program failed: " << getErrorString(err) << std::endl;
          return -1;
       }
+      if (profile) run_profile.add_host("build", timer_stop('u'));
 
       // Create the compute kernel in the program we wish to run
-      kernel = clCreateKernel(program, "vecAdd", &err);
+      clwrap::Kernel kernel_handle = clwrap::create_kernel(program.get(), variant.name.c_str(), &err);
+      cl_kernel kernel = kernel_handle.get();
       if (kernel == nullptr) {
          std::cout << "Create kernel failed" << std::endl;
          return -1;
       }
 
 
-      // Set the arguments to our compute kernel
-      err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_a);
-      err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_b);
-      err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_c);
-      err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &n);
+      // Set the arguments to our compute kernel; the streaming pipeline sets them per chunk
+      err = CL_SUCCESS;
+      if (!stream) {
+         err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_a);
+         err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_b);
+         err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_c);
+         err |= clSetKernelArg(kernel, 3, sizeof(unsigned int), &n);
+      }
       if (err != CL_SUCCESS) {
          std::cout << "Set kernel arg failed" << std::endl;
          return -1;
       }
 
-      // Execute the kernel over the entire range of the data set
-      err = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &globalSize, &localSize,
-                                   0, nullptr, nullptr);
-      if (err != CL_SUCCESS) {
-         std::cout << "Run kernel failed" << std::endl;
-         return -1;
+      // Number of work items in each local work group, 0 leaves it to the runtime
+      if (local_size_option != "auto") {
+         localSize = strtoull(local_size_option.c_str(), nullptr, 10);
+      } else if (stream) {
+         // chunk buffers do not exist yet, so streaming only reuses an earlier tuning of this device
+         if (!tuner.lookup(device_id, variant.key(), n, &localSize))
+            localSize = 8;
+      } else {
+         localSize = tuner.local_size(context, device_id, kernel, variant.key(), n,
+                 [&](cl_command_queue tune_queue, size_t local, cl_event *event) {
+                    size_t global = variant.global_size(n, local);
+                    return clEnqueueNDRangeKernel(tune_queue, kernel, 1, nullptr, &global,
+                                                  local ? &local : nullptr, 0, nullptr, event);
+                 });
       }
+      std::cout << "Kernel " << variant.key() << " on " << device_name
+                << ", local work size " << (localSize ? std::to_string(localSize) : std::string("NULL")) << std::endl;
+
+      // Number of total work items - localSize must be devisor
+      globalSize = variant.global_size(n, localSize);
 
-      // Wait for the command queue to get serviced before reading back results
-      clFinish(queue);
+      // Chunk buffers and queues of the streaming pipeline, kept for all iterations
+      std::unique_ptr<clstream::Pipeline> pipeline;
+      if (stream) {
+         size_t chunk = std::min<size_t>(chunk_elements, clstream::max_chunk_elements(device_id));
+         if (chunk == 0) {
+            std::cout << "Tuning stream chunk size on " << device_name << std::endl;
+            chunk = clstream::tune_chunk(context, device_id, kernel, variant, h_a, h_b, h_c, n, localSize, stream_depth);
+         }
+         chunk = std::min<size_t>(chunk, n);
+         pipeline.reset(new clstream::Pipeline(context, device_id, kernel, variant, chunk, stream_depth,
+                                               profile || collect ? CL_QUEUE_PROFILING_ENABLE : 0, &err));
+         if (err != CL_SUCCESS) {
+            std::cout << "Create stream pipeline failed: " << getErrorString(err) << std::endl;
+            return -1;
+         }
+      }
 
-      // Read the results from the device
-      clEnqueueReadBuffer(queue, d_c, CL_TRUE, 0, bytes, h_c, 0, nullptr, nullptr);
-      if (err != CL_SUCCESS) {
-         std::cout << "Read data failed" << std::endl;
-         return -1;
+      // Device-side checksum; streamed chunks are already on the host, so streaming always sums there
+      std::unique_ptr<clreduce::Reducer> reducer;
+      clreduce::Result reduction;
+      const bool device_checksum = !stream && checksum_mode != "host";
+      const bool fused_checksum = device_checksum && checksum_mode == "fused";
+      if (device_checksum) {
+         reducer.reset(new clreduce::Reducer(context, device_id, program_cache, &err));
+         if (err != CL_SUCCESS) {
+            std::cout << "Create reduction kernels failed: " << getErrorString(err) << std::endl;
+            return -1;
+         }
+         if (fused_checksum)
+            std::cout << "Fused vecAdd_reduce replaces " << variant.key() << std::endl;
+      }
+
+      // Generate a and b straight into the device buffers once; the runs below then skip the upload
+      if (device_init) {
+         if (profile) timer_start("Generate inputs", 'u');
+         clinit::Generator generator(context, device_id, program_cache, &err);
+         cl_event fill_a_event = nullptr, fill_b_event = nullptr;
+         if (err == CL_SUCCESS)
+            err = generator.fill(queue, d_a, n, input_pattern, input_start, input_step, seed, 0, &fill_a_event);
+         if (err == CL_SUCCESS)
+            err = generator.fill(queue, d_b, n, input_pattern, input_start, input_step, seed, 1, &fill_b_event);
+         if (err == CL_SUCCESS)
+            err = clFinish(queue);
+         for (cl_event event : {fill_a_event, fill_b_event})
+            if (event != nullptr) clReleaseEvent(event);
+         if (err != CL_SUCCESS) {
+            std::cout << "Generate inputs failed: " << getErrorString(err) << std::endl;
+            return -1;
+         }
+         if (profile) run_profile.add_host("generate", timer_stop('u'));
+      }
+
+      // Upload, compute and read back; repeated on the same objects in benchmark mode
+      std::vector<double> kernel_ms, transfer_ms, total_ms;
+      // Host view of d_c; the mapped region in zero-copy mode
+      float *result = dst_c;
+      for (int run = 0; run < warmup + iterations; ++run) {
+         // only the events of the last run are kept for the --profile report
+         run_profile.reset_events();
+         auto run_begin = std::chrono::steady_clock::now();
+
+         if (stream) {
+            err = pipeline->run(h_a, h_b, h_c, n, localSize);
+            if (err != CL_SUCCESS) {
+               std::cout << "Streaming run failed: " << getErrorString(err) << std::endl;
+               return -1;
+            }
+            if (collect && run >= warmup) {
+               const clstream::Stats &stats = pipeline->stats();
+               total_ms.push_back(std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - run_begin).count());
+               kernel_ms.push_back(stats.compute_ns / 1e6);
+               transfer_ms.push_back((stats.upload_ns + stats.download_ns) / 1e6);
+            }
+            continue;
+         }
+
+         if (device_init) {
+            err = CL_SUCCESS;
+         } else if (zero_copy) {
+            // Hand the host-resident inputs to the device: map for writing, then unmap, no copy on unified memory
+            cl_mem inputs[] = {d_a, d_b};
+            const char *names[] = {"map a", "map b"};
+            err = CL_SUCCESS;
+            for (int input = 0; input < 2; ++input) {
+               cl_event map_event = nullptr, unmap_event = nullptr;
+               void *mapped = clEnqueueMapBuffer(queue, inputs[input], CL_TRUE, CL_MAP_WRITE, 0, bytes,
+                                                 0, nullptr, &map_event, &err);
+               run_profile.add(names[input], map_event);
+               if (err != CL_SUCCESS)
+                  break;
+               err = clEnqueueUnmapMemObject(queue, inputs[input], mapped, 0, nullptr, &unmap_event);
+               run_profile.add(std::string("un") + names[input], unmap_event);
+            }
+         } else {
+            // Write our data set into the input array in device memory
+            cl_event write_a_event = nullptr, write_b_event = nullptr;
+            err = clEnqueueWriteBuffer(queue, d_a, CL_TRUE, 0,
+                                       bytes, src_a, 0, nullptr, &write_a_event);
+            err |= clEnqueueWriteBuffer(queue, d_b, CL_TRUE, 0,
+                                        bytes, src_b, 0, nullptr, &write_b_event);
+            run_profile.add("write a", write_a_event);
+            run_profile.add("write b", write_b_event);
+         }
+         if (err != CL_SUCCESS) {
+            std::cout << "Enqueue Write Buffer failed" << std::endl;
+            return -1;
+         }
+
+         // Execute the kernel over the entire range of the data set
+         cl_event kernel_event = nullptr;
+         if (fused_checksum)
+            err = reducer->add_reduce(queue, d_a, d_b, d_c, n, &reduction, &kernel_event);
+         else
+            err = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &globalSize, localSize ? &localSize : nullptr,
+                                         0, nullptr, &kernel_event);
+         run_profile.add("vecAdd", kernel_event);
+         if (err != CL_SUCCESS) {
+            std::cout << "Run kernel failed" << std::endl;
+            return -1;
+         }
+         if (device_checksum && !fused_checksum) {
+            cl_event reduce_event = nullptr;
+            err = reducer->reduce(queue, d_c, n, &reduction, &reduce_event);
+            run_profile.add("reduce", reduce_event);
+            if (err != CL_SUCCESS) {
+               std::cout << "Run reduction failed: " << getErrorString(err) << std::endl;
+               return -1;
+            }
+         }
+
+         // Wait for the command queue to get serviced before reading back results
+         clFinish(queue);
+
+         // Read the results from the device; a device checksum only needs the partial sums it already read
+         if (device_checksum) {
+            err = CL_SUCCESS;
+         } else if (zero_copy) {
+            cl_event map_c_event = nullptr;
+            result = (float *) clEnqueueMapBuffer(queue, d_c, CL_TRUE, CL_MAP_READ, 0, bytes,
+                                                  0, nullptr, &map_c_event, &err);
+            run_profile.add("map c", map_c_event);
+            // the last mapping stays in place for the checksum below
+            if (err == CL_SUCCESS && run + 1 < warmup + iterations)
+               err = clEnqueueUnmapMemObject(queue, d_c, result, 0, nullptr, nullptr);
+         } else {
+            cl_event read_c_event = nullptr;
+            err = clEnqueueReadBuffer(queue, d_c, CL_TRUE, 0, bytes, dst_c, 0, nullptr, &read_c_event);
+            run_profile.add("read c", read_c_event);
+         }
+         if (err != CL_SUCCESS) {
+            std::cout << "Read data failed" << std::endl;
+            return -1;
+         }
+
+         if (collect && run >= warmup) {
+            total_ms.push_back(std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - run_begin).count());
+            kernel_ms.push_back((run_profile.device_time("vecAdd") + run_profile.device_time("reduce")) / 1e6);
+            transfer_ms.push_back((run_profile.device_time("write") + run_profile.device_time("read") +
+                                   run_profile.device_time("map") + run_profile.device_time("unmap")) / 1e6);
+         }
       }
 
       //Sum up vector c and print result divided by n, this should equal 1 within error
-      float sum = 0;
-      for (i = 0; i < n; i++)
-         sum += h_c[i];
-      std::cout << "Result on " + platform_device_pair[i_pltf].device_type_name + ": " << sum << std::endl;
-      // release OpenCL resources
-      clReleaseMemObject(d_a);
-      clReleaseMemObject(d_b);
-      clReleaseMemObject(d_c);
-      clReleaseProgram(program);
-      clReleaseKernel(kernel);
-      clReleaseCommandQueue(queue);
-      clReleaseContext(context);
+      if (profile) timer_start("Checksum", 'u');
+      if (device_checksum) {
+         std::cout << "Result on " + device_name + ": " << reduction.sum
+                   << " (device " << checksum_mode << " reduction, min " << reduction.min << ", max "
+                   << reduction.max << ")" << std::endl;
+      } else {
+         float sum = 0;
+         for (i = 0; i < n; i++)
+            sum += result[i];
+         std::cout << "Result on " + device_name + ": " << sum << std::endl;
+      }
+      if (verify) {
+         // a device checksum left c on the device, so it is read back just for the comparison
+         if (device_checksum && clEnqueueReadBuffer(queue, d_c, CL_TRUE, 0, bytes, result, 0, nullptr, nullptr) != CL_SUCCESS) {
+            std::cout << "Read data failed" << std::endl;
+            return -1;
+         }
+         hostverify::Report report = hostverify::verify_add(*verify_pool, h_a, h_b, result, n, verify_ulps);
+         hostverify::print_report(report, verify_ulps);
+         if (report.mismatches)
+            verify_failures++;
+      }
+      if (zero_copy && !device_checksum) {
+         clEnqueueUnmapMemObject(queue, d_c, result, 0, nullptr, nullptr);
+         clFinish(queue);
+      }
+      if (profile) {
+         run_profile.add_host("checksum", timer_stop('u'));
+         run_profile.print(device_name);
+         if (stream) {
+            const clstream::Stats &stats = pipeline->stats();
+            std::cout << "  streamed " << stats.chunks << " chunks of " << pipeline->chunk_elements()
+                      << " elements, device busy ms: upload " << stats.upload_ns / 1e6
+                      << ", compute " << stats.compute_ns / 1e6 << ", download " << stats.download_ns / 1e6 << std::endl;
+         }
+      }
+      if (benchmark) {
+         std::cout << "Benchmark on " << device_name << ": " << iterations
+                   << " iterations after " << warmup << " warm-up" << std::endl;
+         benchstats::print_header("ms");
+         benchstats::print_row("kernel", benchstats::summarize(kernel_ms));
+         benchstats::print_row("transfer", benchstats::summarize(transfer_ms));
+         benchstats::print_row("end-to-end", benchstats::summarize(total_ms));
+      }
+      if (reporting) {
+         // identical boards share CL_DEVICE_NAME; the registry label tells them apart in the baseline
+         benchreport::DeviceInfo info = benchreport::describe(device_id);
+         info.name = entry.label();
+         benchreport::Record &record = report.add(info);
+         record.set("mode", stream ? "stream" : zero_copy ? "zero-copy" : "copy");
+         record.set("n", std::to_string(n));
+         record.set("warmup", std::to_string(warmup));
+         record.set("kernel", fused_checksum ? std::string("vecAdd_reduce") : variant.key());
+         record.set("local_size", std::to_string(localSize));
+         record.set("checksum", device_checksum ? checksum_mode : std::string("host"));
+         record.set("init", device_init ? std::string("device") : init_mode);
+         record.set("input", input_name);
+         record.set("host_memory", pinned ? "pinned" : "pageable");
+         if (stream) {
+            record.set("chunk", std::to_string(pipeline->chunk_elements()));
+            record.set("stream_depth", std::to_string(stream_depth));
+         }
+         record.add("kernel", kernel_ms);
+         record.add("transfer", transfer_ms);
+         record.add("end-to-end", total_ms);
+      }
+      if (arenas.count(device_id) && arenas[device_id]->stats().capacity > 0)
+         arenas[device_id]->print_stats(device_name);
+      // OpenCL objects are released, or handed back to the device pool, as this run's scope ends
       timer_stop('m');
    }
 
-   //release host memory
-   free(h_a);
-   free(h_b);
-   free(h_c);
+   if (native_backend) {
+      run_native(*native_backend, n, h_a, h_b, h_c, warmup, iterations, benchmark, checksum_mode != "host",
+                 reporting ? &report : nullptr);
+      if (verify) {
+         hostverify::Report report = hostverify::verify_add(*verify_pool, h_a, h_b, h_c, n, verify_ulps);
+         hostverify::print_report(report, verify_ulps);
+         if (report.mismatches)
+            verify_failures++;
+      }
+   }
 
+   const int gate_status = write_report();
+   program_cache.print_stats();
+   const clwrap::PoolStats pool_stats = pools.stats();
+   if (pool_stats.created > 0)
+      std::cout << "Device pools: " << pool_stats.created << " queues and buffers created, " << pool_stats.reused
+                << " reused" << std::endl;
 
-   return 0;
+   return verify_failures || gate_status ? -1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,175 @@
+//
+// vecAdd kernels generated from the C++ element type.
+//
+
+#ifndef VEC_KERNEL_HPP
+#define VEC_KERNEL_HPP
+
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <CL/opencl.h>
+#include "kernel_gen.hpp"
+#include "program_cache.hpp"
+
+namespace clkernels {
+
+// Element type tag for OpenCL half; the host keeps the raw IEEE 754 binary16 bits
+struct Half {};
+
+// Round to nearest even binary16, flushing values below the smallest subnormal to zero
+inline cl_half float_to_half(float value) {
+   uint32_t bits;
+   std::memcpy(&bits, &value, sizeof(bits));
+   const uint32_t sign = (bits >> 16) & 0x8000;
+   const int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+   uint32_t mantissa = bits & 0x7fffff;
+   if (((bits >> 23) & 0xff) == 0xff)
+      return static_cast<cl_half>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+   if (exponent >= 31)
+      return static_cast<cl_half>(sign | 0x7c00);
+   if (exponent <= 0) {
+      if (exponent < -10)
+         return static_cast<cl_half>(sign);
+      mantissa |= 0x800000;
+      const int shift = 14 - exponent;
+      uint32_t half = mantissa >> shift;
+      const uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+      if (rest > halfway || (rest == halfway && (half & 1)))
+         ++half;
+      return static_cast<cl_half>(sign | half);
+   }
+   uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+   const uint32_t rest = mantissa & 0x1fff;
+   // a carry out of the mantissa correctly bumps the exponent
+   if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+      ++half;
+   return static_cast<cl_half>(half);
+}
+
+inline float half_to_float(cl_half value) {
+   const uint32_t sign = static_cast<uint32_t>(value & 0x8000) << 16;
+   const uint32_t exponent = (value >> 10) & 0x1f;
+   const uint32_t mantissa = value & 0x3ff;
+   uint32_t bits;
+   if (exponent == 0) {
+      float subnormal = mantissa / 16777216.0f;  // mantissa * 2^-24
+      return sign ? -subnormal : subnormal;
+   } else if (exponent == 31) {
+      bits = sign | 0x7f800000 | (mantissa << 13);
+   } else {
+      bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+   }
+   float result;
+   std::memcpy(&result, &bits, sizeof(result));
+   return result;
+}
+
+/**
+ * Everything the host needs to run vecAdd over one element type T:
+ * the OpenCL C type, the extension it requires, the host buffer type with
+ * the same layout, and conversions used to fill and verify buffers. For
+ * complex types to_double() sums the components, so checks stay linear.
+ */
+template <typename T>
+struct VecKernel;
+
+template <>
+struct VecKernel<float> {
+   typedef cl_float host_type;
+   static const char *label() { return "float"; }
+   static const char *type_name() { return "float"; }
+   static const char *extension() { return ""; }
+   static host_type from_double(double value) { return static_cast<cl_float>(value); }
+   static double to_double(host_type value) { return value; }
+};
+
+template <>
+struct VecKernel<double> {
+   typedef cl_double host_type;
+   static const char *label() { return "double"; }
+   static const char *type_name() { return "double"; }
+   static const char *extension() { return "cl_khr_fp64"; }
+   static host_type from_double(double value) { return value; }
+   static double to_double(host_type value) { return value; }
+};
+
+template <>
+struct VecKernel<Half> {
+   typedef cl_half host_type;
+   static const char *label() { return "half"; }
+   static const char *type_name() { return "half"; }
+   static const char *extension() { return "cl_khr_fp16"; }
+   static host_type from_double(double value) { return float_to_half(static_cast<float>(value)); }
+   static double to_double(host_type value) { return half_to_float(value); }
+};
+
+template <>
+struct VecKernel<int> {
+   typedef cl_int host_type;
+   static const char *label() { return "int"; }
+   static const char *type_name() { return "int"; }
+   static const char *extension() { return ""; }
+   static host_type from_double(double value) { return static_cast<cl_int>(value); }
+   static double to_double(host_type value) { return value; }
+};
+
+template <>
+struct VecKernel<std::complex<float>> {
+   typedef cl_float2 host_type;
+   static const char *label() { return "complex"; }
+   static const char *type_name() { return "float2"; }  // complex addition is componentwise
+   static const char *extension() { return ""; }
+   static host_type from_double(double value) {
+      host_type complex;
+      complex.s[0] = static_cast<cl_float>(value);
+      complex.s[1] = static_cast<cl_float>(2 * value);
+      return complex;
+   }
+   static double to_double(host_type value) { return static_cast<double>(value.s[0]) + value.s[1]; }
+};
+
+// Whether the space separated CL_DEVICE_EXTENSIONS list contains extension
+inline bool has_extension(cl_device_id device, const std::string &extension) {
+   std::istringstream extensions(clcache::device_string(device, CL_DEVICE_EXTENSIONS));
+   std::string name;
+   while (extensions >> name)
+      if (name == extension)
+         return true;
+   return false;
+}
+
+// fp64 and fp16 kernels only build on devices advertising cl_khr_fp64 / cl_khr_fp16
+template <typename T>
+bool supported(cl_device_id device) {
+   const std::string extension = VecKernel<T>::extension();
+   return extension.empty() || has_extension(device, extension);
+}
+
+// One element per work item, kernel named vecAdd_<label> so tuning entries of different types stay apart
+template <typename T>
+Variant typed_vector_add() {
+   typedef VecKernel<T> Traits;
+   const std::string type = Traits::type_name();
+   Variant variant;
+   variant.name = std::string("vecAdd_") + Traits::label();
+   if (*Traits::extension())
+      variant.source = std::string("#pragma OPENCL EXTENSION ") + Traits::extension() + " : enable\n";
+   variant.source +=
+           "__kernel void " + variant.name + "(__global const " + type + " *a,\n"
+           "                       __global const " + type + " *b,\n"
+           "                       __global " + type + " *c,\n"
+           "                       const unsigned int n)\n"
+           "{\n"
+           "    size_t id = get_global_id(0);\n"
+           "    if (id < n)\n"
+           "        c[id] = a[id] + b[id];\n"
+           "}\n";
+   return variant;
+}
+
+}
+
+#endif
@@ -0,0 +1,171 @@
+//
+// Work-group size auto-tuner with a persistent tuning database.
+//
+
+#ifndef WORK_GROUP_TUNER_HPP
+#define WORK_GROUP_TUNER_HPP
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <CL/opencl.h>
+#include "cl_profile.hpp"
+#include "program_cache.hpp"
+
+namespace cltune {
+
+// Enqueue one launch of the tuned kernel on queue with the given local size (0 = NULL local size)
+typedef std::function<cl_int(cl_command_queue queue, size_t local_size, cl_event *event)> Launch;
+
+// Device time in nanoseconds of one candidate setting, 0 when it cannot run
+typedef std::function<cl_ulong(size_t candidate)> Measure;
+
+// Problem size class: floor(log2(n)), so 10M and 16M elements share a tuning entry
+inline int size_class(size_t n) {
+   int bits = 0;
+   while (n > 1) {
+      n >>= 1;
+      ++bits;
+   }
+   return bits;
+}
+
+/**
+ * Picks the fastest local work size per (device, kernel, size class). The
+ * candidates are CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE times powers
+ * of two up to CL_KERNEL_WORK_GROUP_SIZE plus a NULL local size, each timed
+ * with profiling events. choose() tunes any other per-device parameter the
+ * same way. Winners are stored one per line in a text file as
+ * "<device hash> <kernel or parameter> <size class> <value>".
+ */
+class Tuner {
+public:
+   // An empty path keeps results for this process only
+   explicit Tuner(const std::string &path) : path_(path) {
+      if (path_.empty())
+         return;
+      std::ifstream in(path_);
+      std::string line;
+      while (std::getline(in, line)) {
+         std::istringstream fields(line);
+         std::string device, kernel;
+         int size_class;
+         size_t local_size;
+         if (fields >> device >> kernel >> size_class >> local_size)
+            entries_[key(device, kernel, size_class)] = local_size;
+      }
+   }
+
+   // Stored value, or false when this combination has not been tuned yet
+   bool lookup(cl_device_id device, const std::string &kernel_name, size_t n, size_t *local_size) const {
+      auto entry = entries_.find(key(device_hash(device), kernel_name, size_class(n)));
+      if (entry == entries_.end())
+         return false;
+      *local_size = entry->second;
+      return true;
+   }
+
+   // Stored choice for parameter, or the candidate with the lowest nonzero measure(), saved for later runs;
+   // the first candidate, unsaved, if every measure() failed
+   size_t choose(cl_device_id device, const std::string &parameter, size_t n,
+                 const std::vector<size_t> &candidates, const Measure &measure) {
+      size_t best = candidates.empty() ? 0 : candidates.front();
+      if (lookup(device, parameter, n, &best))
+         return best;
+      cl_ulong best_ns = 0;
+      for (size_t candidate : candidates) {
+         cl_ulong ns = measure(candidate);
+         if (ns == 0)
+            continue;
+         std::cout << "  " << parameter << " " << candidate << ": " << ns / 1e6 << " ms" << std::endl;
+         if (best_ns == 0 || ns < best_ns) {
+            best_ns = ns;
+            best = candidate;
+         }
+      }
+      if (best_ns == 0)
+         return best;
+      entries_[key(device_hash(device), parameter, size_class(n))] = best;
+      save();
+      return best;
+   }
+
+   // Stored local size, tuning and saving it first if needed; 0 stands for a NULL local size
+   size_t local_size(cl_context context, cl_device_id device, cl_kernel kernel, const std::string &kernel_name,
+                     size_t n, const Launch &launch) {
+      size_t best;
+      if (lookup(device, kernel_name, n, &best))
+         return best;
+
+      size_t multiple = 1, max_size = 1;
+      clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                               sizeof(multiple), &multiple, nullptr);
+      clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(max_size), &max_size, nullptr);
+      std::vector<size_t> candidates{0};
+      for (size_t size = std::max<size_t>(multiple, 1); size <= max_size; size *= 2)
+         candidates.push_back(size);
+
+      cl_int err;
+      cl_command_queue queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+      if (err != CL_SUCCESS)
+         return 0;
+      std::cout << "Tuning work-group size of " << kernel_name << " (multiple " << multiple
+                << ", max " << max_size << ")" << std::endl;
+      best = choose(device, kernel_name, n, candidates, [&](size_t candidate) {
+         return fastest_launch(queue, [&](cl_command_queue q, cl_event *event) {
+            return launch(q, candidate, event);
+         });
+      });
+      clReleaseCommandQueue(queue);
+      return best;
+   }
+
+   // Device time of the fastest of three launches after an untimed one, 0 if a launch failed
+   static cl_ulong fastest_launch(cl_command_queue queue,
+                                  const std::function<cl_int(cl_command_queue, cl_event *)> &launch) {
+      cl_ulong fastest = 0;
+      for (int repeat = 0; repeat < 4; ++repeat) {
+         cl_event event = nullptr;
+         if (launch(queue, &event) != CL_SUCCESS)
+            return 0;
+         cl_ulong ns = clprofile::event_duration(event);
+         clReleaseEvent(event);
+         if (repeat > 0 && (fastest == 0 || ns < fastest))
+            fastest = ns;
+      }
+      return fastest;
+   }
+
+private:
+   static std::string device_hash(cl_device_id device) {
+      uint64_t hash = clcache::fnv1a(clcache::device_string(device, CL_DEVICE_NAME));
+      hash = clcache::fnv1a(clcache::device_string(device, CL_DRIVER_VERSION), hash);
+      std::ostringstream out;
+      out << std::hex << hash;
+      return out.str();
+   }
+
+   static std::string key(const std::string &device, const std::string &kernel, int size_class) {
+      return device + " " + kernel + " " + std::to_string(size_class);
+   }
+
+   void save() const {
+      if (path_.empty())
+         return;
+      std::ofstream out(path_, std::ios::trunc);
+      for (auto &entry : entries_)
+         out << entry.first << " " << entry.second << "\n";
+   }
+
+   std::string path_;
+   std::map<std::string, size_t> entries_;
+};
+
+}
+
+#endif